@@ -5,7 +5,28 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
+  int bucket;       // bcache bucket it is hashed in, -1 if none
+  int ra;           // read ahead and not used yet
+  void (*done)(struct buf *); // async transfer finished; see virtio_disk_submit
+  struct buf *qnext; // iosched queue; then completed transfers, in virtio_disk_intr()
+  int iowrite;      // iosched: request direction
+  int iopending;    // iosched: queued or on the disk
+  uint64 iotime;    // iosched: when it was queued
+  void (*iodone)(struct buf *); // iosched: the submitter's callback
   struct buf *prev; // LRU cache list
   struct buf *next;
   uchar data[BSIZE];
 };
+
+// bcache_stat()
+struct bcache_stat {
+  uint64 hit;
+  uint64 miss;
+  uint64 evict;     // cached blocks dropped to reuse their buf
+  uint64 shrink;    // pages given back under memory pressure
+  uint64 raissue;   // blocks read ahead
+  uint64 rahit;     // of those, later read by someone
+  uint64 rawaste;   // of those, evicted before use
+  int nbuf;
+  int maxbuf;
+};
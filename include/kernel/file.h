@@ -1,3 +1,10 @@
+// sequential readahead state of an open file; see ireadahead().
+struct rastate {
+  uint prev;         // file offset where the last read ended
+  uint next;         // first block not yet read ahead
+  uint win;          // readahead window in blocks, 0 if not sequential
+};
+
 struct file {
   enum { FD_NONE, FD_PIPE, FD_INODE, FD_DEVICE } type;
   int ref; // reference count
@@ -6,6 +13,7 @@ struct file {
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
+  struct rastate ra; // FD_INODE
   short major;       // FD_DEVICE
 };
 
@@ -27,6 +35,11 @@ struct inode {
   short nlink;
   uint size;
   uint addrs[NDIRECT+1];
+  #ifdef riscv
+  struct dblock *delay; // delayed-allocation blocks, see fs.c
+  int ndelay;
+  uint goal;          // block to allocate next, see ballocfor()
+  #endif
 };
 
 // map major device number to device functions.
@@ -1,10 +1,22 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Bufs are hashed on (dev, blockno) into NBUCKET buckets, each with
+// its own lock and its own LRU list, so lookups of different blocks
+// on different harts do not contend. Only one bucket lock is ever
+// held at a time.
+//
+// Bufs live in pages from kalloc(), BPERPAGE to a page. The cache
+// starts with NBUF bufs and grows a page at a time on misses, up to
+// BCACHE_PCT percent of the memory free at boot; past that a miss
+// recycles the LRU unused buf of its own bucket, or else steals one
+// from another bucket. When kalloc() runs dry it calls
+// bcache_shrink() to take pages of unused bufs back.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -19,42 +31,216 @@
 #include "sleeplock.h"
 #ifdef loongarch
 #include "loongarch.h"
-#define disk_rw ramdiskrw
+#define disk_submit_multi(bs, n, write, done) (-1)  // the ramdisk has nothing to overlap
 #endif
 #ifdef riscv
 #include "riscv.h"
-#define disk_rw virtio_disk_rw
+#define disk_submit_multi iosched_submit_multi
+#define disk_rw_multi iosched_rw
 #endif
 #include "defs.h"
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#ifdef loongarch
+static void
+disk_rw_multi(struct buf **bs, int n, int write)
+{
+  for(int i = 0; i < n; i++)
+    ramdiskrw(bs[i], write);
+}
+#endif
+
+#define NBUCKET 251
+#define BPERPAGE (PGSIZE / sizeof(struct buf))
+#define NOBLOCK (~0U)     // dev and blockno of a buf holding no block
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  // Bufs hashed here, in a circular list through prev/next, sorted
+  // by how recently they were used: head is the most recent,
+  // head->prev the least.
+  struct buf *head;
+  uint64 hit;
+  uint64 miss;
+  uint64 evict;           // valid blocks dropped to reuse their buf
+};
 
-  // Linked list of all buffers, through prev/next.
-  // Sorted by how recently the buffer was used.
-  // head.next is most recent, head.prev is least.
-  struct buf head;
+struct {
+  struct bucket bucket[NBUCKET];
+  struct spinlock shrinklock;   // one shrinker at a time
+  int nbuf;               // bufs allocated; changed atomically
+  int maxbuf;
+  uint64 shrink;          // pages given back to kalloc
+  uint64 raissue;         // readahead counters; see struct bcache_stat
+  uint64 rahit;
+  uint64 rawaste;
 } bcache;
 
-void
-binit(void)
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev * 31 + blockno) % NBUCKET];
+}
+
+// Put b on bk's list, at the most recently used end if mru,
+// else at the least recently used end.
+static void
+blink(struct bucket *bk, struct buf *b, int mru)
+{
+  if(bk->head == 0){
+    b->next = b->prev = b;
+    bk->head = b;
+  } else {
+    b->next = bk->head;
+    b->prev = bk->head->prev;
+    bk->head->prev->next = b;
+    bk->head->prev = b;
+    if(mru)
+      bk->head = b;
+  }
+  b->bucket = bk - bcache.bucket;
+}
+
+static void
+bunlink(struct bucket *bk, struct buf *b)
+{
+  if(b->next == b){
+    bk->head = 0;
+  } else {
+    b->next->prev = b->prev;
+    b->prev->next = b->next;
+    if(bk->head == b)
+      bk->head = b->next;
+  }
+  __atomic_store_n(&b->bucket, -1, __ATOMIC_RELAXED);
+}
+
+// Add an empty buf to bk, where the next miss will take it first.
+static void
+bpark(struct bucket *bk, struct buf *b)
+{
+  b->dev = b->blockno = NOBLOCK;
+  b->valid = 0;
+  blink(bk, b, 0);
+}
+
+// Look for the block in bk. Caller holds bk->lock.
+static struct buf*
+bfind(struct bucket *bk, uint dev, uint blockno)
 {
   struct buf *b;
 
-  initlock(&bcache.lock, "bcache");
+  if((b = bk->head) == 0)
+    return 0;
+  do {
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  } while((b = b->next) != bk->head);
+  return 0;
+}
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
+// The least recently used unused buf in bk, or 0.
+// Caller holds bk->lock.
+static struct buf*
+blru(struct bucket *bk)
+{
+  struct buf *b;
+
+  if(bk->head == 0)
+    return 0;
+  b = bk->head;
+  do {
+    b = b->prev;
+    if(b->refcnt == 0)
+      return b;
+  } while(b != bk->head);
+  return 0;
+}
+
+// Allocate a page of new bufs, unless the cache is at its limit.
+// Returns them linked through next, on no bucket list.
+static struct buf*
+bgrow(void)
+{
+  struct buf *b, *list = 0;
+  char *page;
+  int n;
+
+  n = __atomic_load_n(&bcache.nbuf, __ATOMIC_RELAXED);
+  do {
+    if(n + BPERPAGE > bcache.maxbuf)
+      return 0;
+  } while(!__atomic_compare_exchange_n(&bcache.nbuf, &n, n + BPERPAGE, 0,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  if((page = kalloc()) == 0){
+    __atomic_fetch_sub(&bcache.nbuf, BPERPAGE, __ATOMIC_RELAXED);
+    return 0;
+  }
+  memset(page, 0, PGSIZE);
+  for(b = (struct buf *)page; b < (struct buf *)page + BPERPAGE; b++){
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->bucket = -1;
+    b->next = list;
+    list = b;
+  }
+  return list;
+}
+
+// Take an unused buf out of some other bucket. The buf is on no
+// list when this returns, so nobody else can find it.
+static struct buf*
+bsteal(struct bucket *self)
+{
+  struct bucket *bk = self;
+  struct buf *b;
+
+  for(int i = 1; i < NBUCKET; i++){
+    if(++bk == bcache.bucket+NBUCKET)
+      bk = bcache.bucket;
+    if(__atomic_load_n(&bk->head, __ATOMIC_RELAXED) == 0)
+      continue;
+    acquire(&bk->lock);
+    if((b = blru(bk)) != 0){
+      if(b->dev != NOBLOCK)
+        bk->evict++;
+      bunlink(bk, b);
+      release(&bk->lock);
+      b->next = 0;
+      return b;
+    }
+    release(&bk->lock);
+  }
+  return 0;
+}
+
+void
+binit(void)
+{
+  struct buf *b, *list;
+  struct bucket *bk;
+  int i = 0;
+
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++)
+    initlock(&bk->lock, "bcache.bucket");
+  initlock(&bcache.shrinklock, "bcache.shrink");
+
+#ifdef riscv
+  uint64 free;
+  freebytes(&free);
+  bcache.maxbuf = free / PGSIZE * BCACHE_PCT / 100 * BPERPAGE;
+#endif
+  if(bcache.maxbuf < NBUF)
+    bcache.maxbuf = NBUF;
+
+  // Start with NBUF bufs spread over the buckets.
+  while(bcache.nbuf < NBUF){
+    if((list = bgrow()) == 0)
+      panic("binit");
+    while((b = list) != 0){
+      list = b->next;
+      bpark(&bcache.bucket[i++ % NBUCKET], b);
+    }
   }
 }
 
@@ -64,34 +250,156 @@ binit(void)
 static struct buf*
 bget(uint dev, uint blockno)
 {
-  struct buf *b;
+  struct bucket *bk = bhash(dev, blockno);
+  struct buf *b, *spare;
 
-  acquire(&bcache.lock);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = bfind(bk, dev, blockno)) != 0){
+    bk->hit++;
+    goto found;
   }
+  bk->miss++;
 
   // Not cached.
-  // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Use an empty buf of this bucket if there is one. Otherwise grow
+  // the cache while it may, and recycle the least recently used
+  // (LRU) unused buf only after that; steal one from another bucket
+  // if this one has none. bk is unlocked meanwhile, so look again.
+  b = blru(bk);
+  if(b == 0 || (b->dev != NOBLOCK &&
+                __atomic_load_n(&bcache.nbuf, __ATOMIC_RELAXED) + BPERPAGE <= bcache.maxbuf)){
+    release(&bk->lock);
+    spare = bgrow();
+    if(spare == 0 && b == 0)
+      spare = bsteal(bk);
+    acquire(&bk->lock);
+    while((b = spare) != 0){
+      spare = b->next;
+      bpark(bk, b);
+    }
+    if((b = bfind(bk, dev, blockno)) != 0)
+      goto found;
+    if((b = blru(bk)) == 0)
+      panic("bget: no buffers");
+  }
+  if(b->dev != NOBLOCK)
+    bk->evict++;
+  if(b->ra){
+    b->ra = 0;
+    __atomic_fetch_add(&bcache.rawaste, 1, __ATOMIC_RELAXED);
+  }
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
+
+found:
+  b->refcnt++;
+  release(&bk->lock);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Free the page holding b if every buf on it is unused.
+static int
+bfreepage(struct buf *b)
+{
+  struct buf *bufs = (struct buf *)PGROUNDDOWN((uint64)b);
+  struct bucket *bk;
+  int home[BPERPAGE];
+  int i, k, n;
+
+  // never shrink below NBUF.
+  n = __atomic_load_n(&bcache.nbuf, __ATOMIC_RELAXED);
+  do {
+    if(n - BPERPAGE < NBUF)
+      return 0;
+  } while(!__atomic_compare_exchange_n(&bcache.nbuf, &n, n - BPERPAGE, 0,
+                                       __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  for(i = 0; i < BPERPAGE; i++){
+    b = &bufs[i];
+    // -1: on its way between lists in someone else's hands.
+    if((k = __atomic_load_n(&b->bucket, __ATOMIC_RELAXED)) < 0)
+      break;
+    bk = &bcache.bucket[k];
+    acquire(&bk->lock);
+    if(b->bucket != k || b->refcnt != 0){
+      release(&bk->lock);
+      break;
     }
+    if(b->dev != NOBLOCK)
+      bk->evict++;
+    bunlink(bk, b);
+    home[i] = k;
+    release(&bk->lock);
+  }
+  if(i == BPERPAGE){
+    kfree((char *)bufs);
+    __atomic_fetch_add(&bcache.shrink, 1, __ATOMIC_RELAXED);
+    return 1;
   }
-  panic("bget: no buffers");
+
+  // some buf is in use: put back the ones already taken off,
+  // each into the bucket it came from. they go back empty, since
+  // a miss meanwhile may have read the same block into another buf.
+  while(--i >= 0){
+    bk = &bcache.bucket[home[i]];
+    acquire(&bk->lock);
+    bpark(bk, &bufs[i]);
+    release(&bk->lock);
+  }
+  __atomic_fetch_add(&bcache.nbuf, BPERPAGE, __ATOMIC_RELAXED);
+  return 0;
+}
+
+// Give up to npages pages of unused bufs back to kalloc().
+// Called when memory runs out. Shrinkers are serialized so that
+// one cannot free a page another is still looking at.
+int
+bcache_shrink(int npages)
+{
+  struct bucket *bk;
+  struct buf *b;
+  int freed = 0;
+
+  acquire(&bcache.shrinklock);
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET && freed < npages; bk++){
+    if(__atomic_load_n(&bk->head, __ATOMIC_RELAXED) == 0)
+      continue;
+    acquire(&bk->lock);
+    b = blru(bk);
+    release(&bk->lock);
+    // b may be reused meanwhile; bfreepage() checks again.
+    if(b && bfreepage(b))
+      freed++;
+  }
+  release(&bcache.shrinklock);
+  return freed;
+}
+
+void
+bcache_stat(struct bcache_stat *st)
+{
+  struct bucket *bk;
+
+  memset(st, 0, sizeof(*st));
+  for(bk = bcache.bucket; bk < bcache.bucket+NBUCKET; bk++){
+    st->hit += bk->hit;
+    st->miss += bk->miss;
+    st->evict += bk->evict;
+  }
+  st->shrink = bcache.shrink;
+  st->raissue = bcache.raissue;
+  st->rahit = bcache.rahit;
+  st->rawaste = bcache.rawaste;
+  st->nbuf = bcache.nbuf;
+  st->maxbuf = bcache.maxbuf;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -102,57 +410,191 @@ bread(uint dev, uint blockno)
 
   b = bget(dev, blockno);
   if(!b->valid) {
-    disk_rw(b, 0);
+    disk_rw_multi(&b, 1, 0);
     b->valid = 1;
   }
+  if(b->ra){
+    b->ra = 0;
+    __atomic_fetch_add(&bcache.rahit, 1, __ATOMIC_RELAXED);
+  }
   return b;
 }
 
+// Return locked bufs for the n blocks starting at blockno in bs[].
+// Each run of them that is not cached is read with as few disk
+// requests as possible.
+void
+bread_multi(uint dev, uint blockno, int n, struct buf **bs)
+{
+  int i, j;
+
+  for(i = 0; i < n; i++)
+    bs[i] = bget(dev, blockno + i);
+  for(i = 0; i < n; i = j){
+    for(j = i; j < n && !bs[j]->valid; j++)
+      ;
+    if(j == i){
+      j++;
+      continue;
+    }
+    disk_rw_multi(bs + i, j - i, 0);
+    for(int k = i; k < j; k++)
+      bs[k]->valid = 1;
+  }
+  for(i = 0; i < n; i++){
+    if(bs[i]->ra){
+      bs[i]->ra = 0;
+      __atomic_fetch_add(&bcache.rahit, 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+// Write the locked bufs bs[0..n-1] to disk and wait. Runs of
+// consecutive blocks in bs[] go out as single disk requests.
+void
+bwrite_multi(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++)
+    if(!holdingsleep(&bs[i]->lock))
+      panic("bwrite_multi");
+  disk_rw_multi(bs, n, 1);
+}
+
+// A locked buf to read block blockno ahead into,
+// or 0 if the block is cached.
+static struct buf*
+bgetahead(uint dev, uint blockno)
+{
+  struct bucket *bk = bhash(dev, blockno);
+  struct buf *b;
+
+  acquire(&bk->lock);
+  b = bfind(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return 0;
+
+  b = bget(dev, blockno);
+  if(b->valid){
+    brelse(b);
+    return 0;
+  }
+  b->ra = 1;
+  return b;
+}
+
+// Start reading ahead the run of blocks rd[0..n-1] as one request.
+// The bufs stay locked while the read is in flight; bread() of one
+// waits in acquiresleep(). If the disk queue is full, give up on
+// them and return -1.
+static int
+bstartahead(struct buf **rd, int n)
+{
+  if(n == 0)
+    return 0;
+  if(disk_submit_multi(rd, n, 0, bio_readdone) < 0){
+    for(int i = 0; i < n; i++){
+      rd[i]->ra = 0;
+      brelse(rd[i]);
+    }
+    return -1;
+  }
+  __atomic_fetch_add(&bcache.raissue, n, __ATOMIC_RELAXED);
+  return 0;
+}
+
+// Start reading the n blocks from blockno on, which are likely to
+// be needed soon, without waiting for them. Cached blocks are
+// skipped and each run of the others goes out as one request.
+void
+breadahead(uint dev, uint blockno, int n)
+{
+  struct buf *rd[MAXRUNBLOCKS], *b;
+  int nrd = 0;
+
+  for(uint bn = blockno; bn < blockno + n; bn++){
+    if((b = bgetahead(dev, bn)) != 0){
+      rd[nrd++] = b;
+      if(nrd < MAXRUNBLOCKS)
+        continue;
+    }
+    // bn is cached or the run is full.
+    if(bstartahead(rd, nrd) < 0)
+      return;
+    nrd = 0;
+  }
+  bstartahead(rd, nrd);
+}
+
+// Called from the disk interrupt when a read started by
+// breadahead() is done. Like brelse(), but the process that
+// locked b is not around anymore.
+void
+bio_readdone(struct buf *b)
+{
+  struct bucket *bk;
+
+  b->valid = 1;
+  releasesleep(&b->lock);
+
+  bk = &bcache.bucket[b->bucket];
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    bunlink(bk, b);
+    blink(bk, b, 1);
+  }
+  release(&bk->lock);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  disk_rw(b, 1);
+  disk_rw_multi(&b, 1, 1);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Move to the head of its bucket's most-recently-used list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bk;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  // b stays in its bucket while refcnt > 0.
+  bk = &bcache.bucket[b->bucket];
+  acquire(&bk->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bunlink(bk, b);
+    blink(bk, b, 1);
   }
   
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[b->bucket];
+
+  acquire(&bk->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bk = &bcache.bucket[b->bucket];
+
+  acquire(&bk->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bk->lock);
 }
-
@@ -96,7 +96,11 @@ my_exec(char *path, char **argv)
   ip = 0;
 
   p = myproc();
+  #ifdef riscv
+  uint64 oldsz = p->mm->sz;
+  #else
   uint64 oldsz = p->sz;
+  #endif
 
   // Allocate some pages at the next page boundary.
   // Make the first inaccessible as a stack guard.
@@ -157,7 +161,11 @@ my_exec(char *path, char **argv)
   // Commit to the user image.
   oldpagetable = p->pagetable;
   p->pagetable = pagetable;
+  #ifdef riscv
+  p->mm->sz = sz;
+  #else
   p->sz = sz;
+  #endif
   #ifdef riscv
   p->trapframe->epc = elf.entry;  // initial program counter = ulib.c:start()
   #endif
@@ -40,6 +40,7 @@ filealloc(void)
   for(f = ftable.file; f < ftable.file + NFILE; f++){
     if(f->ref == 0){
       f->ref = 1;
+      memset(&f->ra, 0, sizeof(f->ra));
       release(&ftable.lock);
       return f;
     }
@@ -124,6 +125,7 @@ fileread(struct file *f, uint64 addr, int n)
     r = devsw[f->major].read(1, addr, n);
   } else if(f->type == FD_INODE){
     ilock(f->ip);
+    ireadahead(f->ip, &f->ra, f->off, n);
     if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
       f->off += r;
     iunlock(f->ip);
@@ -155,13 +157,26 @@ filewrite(struct file *f, uint64 addr, int n)
     // the maximum log transaction size, including
     // i-node, indirect block, allocation blocks,
     // and 2 blocks of slop for non-aligned writes.
+    #ifdef riscv
+    // the data blocks are not logged (log_data()), so only
+    // the data a transaction can carry limits the chunk,
+    // with 1 block of slop for non-aligned writes.
+    int max = (OPDATABLOCKS-1) * BSIZE;
+    #else
     int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+    #endif
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
+      #ifdef riscv
+      // blocks freed by transactions not yet committed can't be
+      // allocated; let them commit before the disk looks full.
+      if(balloc_nfree() < OPDATABLOCKS && balloc_npend() > 0)
+        log_force();
+      #endif
       begin_op();
       ilock(f->ip);
       if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
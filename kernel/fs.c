@@ -31,6 +31,15 @@
 // only one device
 struct superblock sb; 
 
+#ifdef riscv
+static void dinit(void);
+static void bsuminit(int);
+static uint dlowest(struct inode*);
+static void dfreeall(struct inode*);
+static void dput(struct inode*);
+static void flush_thread(void);
+#endif
+
 // Read the super block.
 static void
 readsb(int dev, struct superblock *sb)
@@ -50,11 +59,18 @@ fsinit(int dev) {
     panic("invalid file system");
   initlog(dev, &sb);
   #ifdef riscv
+  bsuminit(dev);
   ireclaim(dev);
+  if(kthread_create("flushd", flush_thread) < 0)
+    panic("fsinit: flushd");
   #endif
 }
 
 // Zero a block.
+// On riscv the zeroes go out as ordered data, so a new block
+// reaches the disk zeroed before the transaction that allocated
+// it commits; a block used for metadata is logged as well by
+// whoever fills it in.
 static void
 bzero(int dev, int bno)
 {
@@ -62,12 +78,222 @@ bzero(int dev, int bno)
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
+  #ifdef riscv
+  log_data(bp);
+  #else
   log_write(bp);
+  #endif
   brelse(bp);
 }
 
 // Blocks.
 
+#ifdef riscv
+// The block allocator keeps an in-memory summary of the bitmap,
+// built by bsuminit() at boot: the number of free blocks in each
+// 64-block word of the bitmap, and in all. balloc_range() looks
+// at the summary to skip full words, and at the bitmap a word at
+// a time. It starts from a goal block, the block after the
+// previous one of the same file (see ballocfor()), so a file's
+// blocks come out contiguous; without a goal it goes on from
+// where the last allocation ended. The summary of a word is
+// changed only with its bitmap block locked.
+//
+// A block freed by bfree() is clear in the bitmap at once, but
+// stays in pend[] until the transaction that freed it commits:
+// until then the committed metadata may still point at it, and
+// log_data() would write a new owner's data over it before the
+// commit. logd hands the blocks back with balloc_release().
+#define BWORDS ((FSSIZE + 63) / 64)
+
+struct {
+  uchar wfree[BWORDS];  // free blocks in each bitmap word
+  uint64 pend[BWORDS];  // freed, waiting for their transaction
+  int npend;
+  int nfree;
+  uint rotor;           // where the last allocation ended
+  uint64 nalloc;
+  uint64 nword;         // bitmap words looked at
+} bsum;
+
+// bitmap word w of bp, with the blocks past the end of the
+// disk taken as in use.
+static uint64
+bword(struct buf *bp, uint w)
+{
+  uint64 x = ((uint64 *)bp->data)[w % (BPB / 64)];
+
+  if(w * 64 + 64 > sb.size)
+    x |= ~0UL << (sb.size - w * 64);
+  return x;
+}
+
+// number of 0 bits in x. The kernel is not linked with
+// libgcc, so no __builtin_popcount()/__builtin_ctz().
+static int
+bzeros(uint64 x)
+{
+  int n = 64;
+
+  for(; x; x &= x - 1)
+    n--;
+  return n;
+}
+
+// index of the lowest 0 bit of x, which must have one.
+static int
+bfirst0(uint64 x)
+{
+  int i = 0;
+
+  while((x & 0xff) == 0xff){
+    x >>= 8;
+    i += 8;
+  }
+  while(x & 1){
+    x >>= 1;
+    i++;
+  }
+  return i;
+}
+
+static void
+bsuminit(int dev)
+{
+  struct buf *bp = 0;
+  uint w;
+
+  if(sb.size > BWORDS * 64)
+    panic("bsuminit: disk too big");
+  for(w = 0; w * 64 < sb.size; w++){
+    if(w % (BPB / 64) == 0){
+      if(bp)
+        brelse(bp);
+      bp = bread(dev, BBLOCK(w * 64, sb));
+    }
+    bsum.wfree[w] = bzeros(bword(bp, w));
+    bsum.nfree += bsum.wfree[w];
+  }
+  if(bp)
+    brelse(bp);
+}
+
+// Allocate up to n consecutive zeroed blocks, starting at the
+// first free block at or after goal (wrapping around), and set
+// *got to how many. Returns the first block, or 0 if out of
+// disk space.
+uint
+balloc_range(uint dev, uint goal, int n, int *got)
+{
+  uint nw = (sb.size + 63) / 64, w, b;
+  uint64 x;
+  struct buf *bp;
+  int cnt;
+
+  if(goal == 0 || goal >= sb.size)
+    goal = bsum.rotor;
+  // nw+1 words: the goal's word again at the end, for the
+  // blocks before the goal.
+  for(int i = 0; i <= nw; i++){
+    w = (goal / 64 + i) % nw;
+    if(__atomic_load_n(&bsum.wfree[w], __ATOMIC_RELAXED) == 0)
+      continue;
+    bp = bread(dev, BBLOCK(w * 64, sb));
+    x = bword(bp, w) | bsum.pend[w];
+    if(i == 0)
+      x |= (1UL << (goal % 64)) - 1;
+    bsum.nword++;
+    if(x == ~0UL){
+      brelse(bp);
+      continue;
+    }
+    b = w * 64 + bfirst0(x);
+    for(cnt = 0; cnt < n && b + cnt < sb.size; cnt++){
+      uint bi = (b + cnt) % BPB;
+      if(cnt > 0 && (bi == 0 || (bp->data[bi/8] & (1 << (bi % 8))) ||
+                     (bsum.pend[(b + cnt) / 64] & (1UL << ((b + cnt) % 64)))))
+        break;
+      bp->data[bi/8] |= 1 << (bi % 8);  // Mark block in use.
+      bsum.wfree[(b + cnt) / 64]--;
+    }
+    log_write(bp);
+    brelse(bp);
+    __atomic_fetch_sub(&bsum.nfree, cnt, __ATOMIC_RELAXED);
+    bsum.rotor = b + cnt;
+    bsum.nalloc += cnt;
+    for(int k = 0; k < cnt; k++)
+      bzero(dev, b + k);
+    *got = cnt;
+    return b;
+  }
+  printf("balloc: out of blocks\n");
+  return 0;
+}
+
+// Allocate a block for ip, after the last one allocated for it.
+static uint
+ballocfor(struct inode *ip)
+{
+  uint addr;
+  int got;
+
+  if(ip->goal == 0)
+    for(int i = 0; i < NDIRECT; i++)
+      if(ip->addrs[i])
+        ip->goal = ip->addrs[i] + 1;
+  if((addr = balloc_range(ip->dev, ip->goal, 1, &got)) != 0)
+    ip->goal = addr + 1;
+  return addr;
+}
+
+// Free blocks, for delayed allocation to leave room for.
+int
+balloc_nfree(void)
+{
+  return __atomic_load_n(&bsum.nfree, __ATOMIC_RELAXED);
+}
+
+// Blocks freed by transactions that have not committed yet.
+int
+balloc_npend(void)
+{
+  return __atomic_load_n(&bsum.npend, __ATOMIC_RELAXED);
+}
+
+// The transaction that freed the blocks in freed[] (a bitmap
+// of BWORDS words) has committed; they can be allocated again.
+// Called by logd.
+void
+balloc_release(int dev, uint64 *freed)
+{
+  struct buf *bp;
+  int n;
+
+  for(uint w = 0; w < BWORDS; w++){
+    if(freed[w] == 0)
+      continue;
+    n = 64 - bzeros(freed[w]);
+    bp = bread(dev, BBLOCK(w * 64, sb));
+    bsum.pend[w] &= ~freed[w];
+    bsum.wfree[w] += n;
+    __atomic_fetch_add(&bsum.nfree, n, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&bsum.npend, n, __ATOMIC_RELAXED);
+    brelse(bp);
+  }
+}
+
+// for statistics. free counts the pending blocks too: they are
+// free on disk once logd has committed.
+int
+balloc_stats(char *buf, int sz)
+{
+  return snprintf(buf, sz, "--- balloc: free %d pending %d allocs %d words %d\n",
+                  bsum.nfree + bsum.npend, bsum.npend, (int)bsum.nalloc,
+                  (int)bsum.nword);
+}
+#endif
+
+#ifdef loongarch
 // Allocate a zeroed disk block.
 // returns 0 if out of disk space.
 static uint
@@ -98,6 +324,14 @@ balloc(uint dev)
   return 0;
 }
 
+// Allocate a block for ip.
+static uint
+ballocfor(struct inode *ip)
+{
+  return balloc(ip->dev);
+}
+#endif
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -111,6 +345,12 @@ bfree(int dev, uint b)
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
+  #ifdef riscv
+  // not reusable before this transaction commits.
+  bsum.pend[b / 64] |= 1UL << (b % 64);
+  __atomic_fetch_add(&bsum.npend, 1, __ATOMIC_RELAXED);
+  log_free(b);
+  #endif
   log_write(bp);
   brelse(bp);
 }
@@ -178,7 +418,11 @@ bfree(int dev, uint b)
 // The itable.lock spin-lock protects the allocation of itable
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// holds, one must hold itable.lock while changing any of those
+// fields. iget() looks entries up without the lock: ip->ref is
+// updated atomically, a lookup only takes a reference on an entry
+// whose ref is already non-zero, and rechecks dev and inum after.
+// Table entries are never freed, so a stale read is harmless.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
@@ -198,6 +442,9 @@ iinit()
   for(i = 0; i < NINODE; i++) {
     initsleeplock(&itable.inode[i].lock, "inode");
   }
+  #ifdef riscv
+  dinit();
+  #endif
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -249,6 +496,11 @@ iupdate(struct inode *ip)
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
   dip->size = ip->size;
+  #ifdef riscv
+  // the disk has blocks only up to the first delayed one.
+  if(ip->ndelay && dip->size > dlowest(ip) * BSIZE)
+    dip->size = dlowest(ip) * BSIZE;
+  #endif
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
@@ -257,18 +509,47 @@ iupdate(struct inode *ip)
 // Find the inode with number inum on device dev
 // and return the in-memory copy. Does not lock
 // the inode and does not read it from disk.
+// Take a reference on ip unless its ref is zero (the entry is
+// free, or being recycled under itable.lock).
+static int
+iget_tryref(struct inode *ip)
+{
+  int ref = __atomic_load_n(&ip->ref, __ATOMIC_RELAXED);
+
+  while(ref > 0){
+    if(__atomic_compare_exchange_n(&ip->ref, &ref, ref + 1, 0,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return 1;
+  }
+  return 0;
+}
+
 static struct inode*
 iget(uint dev, uint inum)
 {
   struct inode *ip, *empty;
 
+  // Fast path: the inode is usually cached already.
+  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
+    if(__atomic_load_n(&ip->inum, __ATOMIC_RELAXED) != inum ||
+       __atomic_load_n(&ip->dev, __ATOMIC_RELAXED) != dev)
+      continue;
+    if(!iget_tryref(ip))
+      break;
+    if(ip->dev == dev && ip->inum == inum)
+      return ip;
+    // recycled for another inode in the meantime.
+    iput(ip);
+    break;
+  }
+
   acquire(&itable.lock);
 
   // Is the inode already in the table?
   empty = 0;
   for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
     if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+      __atomic_fetch_add(&ip->ref, 1, __ATOMIC_RELAXED);
       release(&itable.lock);
       return ip;
     }
@@ -283,8 +564,9 @@ iget(uint dev, uint inum)
   ip = empty;
   ip->dev = dev;
   ip->inum = inum;
-  ip->ref = 1;
   ip->valid = 0;
+  // publish dev and inum before the entry looks in use.
+  __atomic_store_n(&ip->ref, 1, __ATOMIC_RELEASE);
   release(&itable.lock);
 
   return ip;
@@ -295,9 +577,7 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
-  ip->ref++;
-  release(&itable.lock);
+  __atomic_fetch_add(&ip->ref, 1, __ATOMIC_RELAXED);
   return ip;
 }
 
@@ -324,6 +604,9 @@ ilock(struct inode *ip)
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
+    #ifdef riscv
+    ip->goal = 0;
+    #endif
     ip->valid = 1;
     if(ip->type == 0)
       panic("ilock: no type");
@@ -371,7 +654,7 @@ iput(struct inode *ip)
     acquire(&itable.lock);
   }
 
-  ip->ref--;
+  __atomic_fetch_sub(&ip->ref, 1, __ATOMIC_RELEASE);
   release(&itable.lock);
 }
 
@@ -423,7 +706,7 @@ bmap(struct inode *ip, uint bn)
   struct buf *bp;
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = ballocfor(ip);
       if(addr == 0)
         return 0;
       ip->addrs[bn] = addr;
@@ -435,7 +718,7 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0){
-      addr = balloc(ip->dev);
+      addr = ballocfor(ip);
       if(addr == 0)
         return 0;
       ip->addrs[NDIRECT] = addr;
@@ -443,7 +726,7 @@ bmap(struct inode *ip, uint bn)
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      addr = balloc(ip->dev);
+      addr = ballocfor(ip);
       if(addr){
         a[bn] = addr;
         log_write(bp);
@@ -456,6 +739,25 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Like bmap(), but never allocates: returns 0 if block bn
+// of ip has no disk block yet.
+static uint
+bpeek(struct inode *ip, uint bn)
+{
+  uint addr;
+  struct buf *bp;
+
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+  if(bn >= NINDIRECT || ip->addrs[NDIRECT] == 0)
+    return 0;
+  bp = bread(ip->dev, ip->addrs[NDIRECT]);
+  addr = ((uint*)bp->data)[bn];
+  brelse(bp);
+  return addr;
+}
+
 // Truncate inode (discard contents).
 // Caller must hold ip->lock.
 void
@@ -465,6 +767,12 @@ itrunc(struct inode *ip)
   struct buf *bp;
   uint *a;
 
+  #ifdef riscv
+  if(ip->ndelay){
+    dfreeall(ip);
+    dput(ip);
+  }
+  #endif
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -485,9 +793,294 @@ itrunc(struct inode *ip)
   }
 
   ip->size = 0;
+  #ifdef riscv
+  ip->goal = 0;
+  #endif
   iupdate(ip);
 }
 
+#ifdef riscv
+// Delayed allocation.
+//
+// A write to a file block that has no disk block yet does not
+// allocate one: the data is kept in a dblock on the inode's
+// delay list, and no transaction is needed. The blocks are
+// allocated and written, lowest first so that they come out
+// contiguous, by iflush(): from the flusher thread every
+// FLUSHTICKS ticks, when more than half the NDELAY dblocks are
+// in use or all NDELAYINODE slots are taken, and from fsync().
+// The disk copy of the inode keeps the size up to the first
+// delayed block (see iupdate()).
+//
+// An inode with delayed blocks holds a reference to itself, so
+// it stays in the table until they are flushed; at most
+// NDELAYINODE inodes do, to leave the table for the others. If
+// the dblocks or these slots run out, writei() falls back to
+// allocating at once.
+
+struct dblock {
+  struct dblock *next;
+  uint bn;                 // block number in the file
+  uchar data[BSIZE];
+};
+
+struct {
+  struct spinlock lock;
+  struct dblock dblock[NDELAY];
+  struct dblock *free;
+  int nused;
+  int ninode;              // inodes holding delayed blocks
+  uint64 nflush;           // dblocks written by iflush()
+  uint64 nfallback;        // writes that found no free dblock
+} dpool;
+
+static void
+dinit(void)
+{
+  initlock(&dpool.lock, "dpool");
+  for(int i = 0; i < NDELAY; i++){
+    dpool.dblock[i].next = dpool.free;
+    dpool.free = &dpool.dblock[i];
+  }
+}
+
+static struct dblock*
+dalloc(void)
+{
+  struct dblock *d;
+
+  acquire(&dpool.lock);
+  if((d = dpool.free) != 0){
+    dpool.free = d->next;
+    dpool.nused++;
+  } else {
+    dpool.nfallback++;
+  }
+  release(&dpool.lock);
+  return d;
+}
+
+// Take one of the NDELAYINODE slots for an inode about to get
+// its first delayed block. Returns 0 if there is none.
+static int
+dhold(void)
+{
+  int ok;
+
+  acquire(&dpool.lock);
+  if((ok = dpool.ninode < NDELAYINODE) != 0)
+    dpool.ninode++;
+  else
+    dpool.nfallback++;
+  release(&dpool.lock);
+  return ok;
+}
+
+// Give the slot back, and the reference the delayed blocks held.
+static void
+dput(struct inode *ip)
+{
+  acquire(&dpool.lock);
+  dpool.ninode--;
+  release(&dpool.lock);
+  if(ip)
+    iput(ip);
+}
+
+static void
+dfree(struct dblock *d)
+{
+  acquire(&dpool.lock);
+  d->next = dpool.free;
+  dpool.free = d;
+  dpool.nused--;
+  release(&dpool.lock);
+}
+
+// The dblock for block bn of ip, or 0.
+// The list is kept highest block first, where appends go.
+static struct dblock*
+dlookup(struct inode *ip, uint bn)
+{
+  struct dblock *d;
+
+  for(d = ip->delay; d && d->bn >= bn; d = d->next)
+    if(d->bn == bn)
+      return d;
+  return 0;
+}
+
+// The dblock to write block bn of ip into: an existing one,
+// or a new zeroed one if bn has no disk block. Returns 0 if
+// the write has to go to the disk block.
+// Caller must hold ip->lock.
+static struct dblock*
+dget(struct inode *ip, uint bn)
+{
+  struct dblock *d, **pp;
+
+  if((d = dlookup(ip, bn)) != 0)
+    return d;
+  if(bpeek(ip, bn) != 0)
+    return 0;
+  // leave the disk room for every delayed block, and an
+  // indirect block for each inode with some; else the write
+  // allocates at once, and can fail as it should.
+  if(balloc_nfree() <= __atomic_load_n(&dpool.nused, __ATOMIC_RELAXED) + NDELAYINODE)
+    return 0;
+  if(ip->ndelay == 0 && !dhold())
+    return 0;
+  if((d = dalloc()) == 0){
+    if(ip->ndelay == 0)
+      dput(0);
+    return 0;
+  }
+  memset(d->data, 0, BSIZE);
+  d->bn = bn;
+  for(pp = &ip->delay; *pp && (*pp)->bn > bn; pp = &(*pp)->next)
+    ;
+  d->next = *pp;
+  *pp = d;
+  if(ip->ndelay++ == 0)
+    idup(ip);
+  return d;
+}
+
+// Lowest delayed block of ip.
+static uint
+dlowest(struct inode *ip)
+{
+  struct dblock *d;
+
+  for(d = ip->delay; d->next; d = d->next)
+    ;
+  return d->bn;
+}
+
+// Remove the lowest delayed block from ip's list.
+static struct dblock*
+dpoplowest(struct inode *ip)
+{
+  struct dblock *d, **pp;
+
+  for(pp = &ip->delay; (*pp)->next; pp = &(*pp)->next)
+    ;
+  d = *pp;
+  *pp = 0;
+  ip->ndelay--;
+  return d;
+}
+
+// Throw away ip's delayed blocks (truncate, or the file is
+// gone). The caller drops the reference they held.
+// Caller must hold ip->lock.
+static void
+dfreeall(struct inode *ip)
+{
+  struct dblock *d;
+
+  while((d = ip->delay) != 0){
+    ip->delay = d->next;
+    dfree(d);
+  }
+  ip->ndelay = 0;
+}
+
+// Allocate and write ip's delayed blocks, OPDATABLOCKS-1 to
+// a transaction. Caller holds a reference to ip, but not
+// ip->lock, and must not be in a transaction.
+void
+iflush(struct inode *ip)
+{
+  struct dblock *d;
+  struct buf *bp;
+  uint addr;
+  int n, had, done;
+
+  do {
+    begin_op();
+    ilock(ip);
+    n = 0;
+    had = ip->ndelay > 0;
+    // unlinked: the blocks would only be freed again by the
+    // final iput(), don't allocate them.
+    if(ip->nlink == 0)
+      dfreeall(ip);
+    while(ip->ndelay && n < OPDATABLOCKS-1){
+      if((addr = bmap(ip, dlowest(ip))) == 0){
+        // the file ends where its blocks do.
+        printf("iflush: out of blocks, inode %d loses data\n", ip->inum);
+        if(ip->size > dlowest(ip) * BSIZE)
+          ip->size = dlowest(ip) * BSIZE;
+        dfreeall(ip);
+        iupdate(ip);
+        break;
+      }
+      d = dpoplowest(ip);
+      bp = bread(ip->dev, addr);
+      memmove(bp->data, d->data, BSIZE);
+      log_data(bp);
+      brelse(bp);
+      dfree(d);
+      n++;
+    }
+    if(n > 0){
+      acquire(&dpool.lock);
+      dpool.nflush += n;
+      release(&dpool.lock);
+      iupdate(ip);
+    }
+    done = ip->ndelay == 0;
+    iunlock(ip);
+    if(had && done)
+      dput(ip);
+    end_op();
+  } while(!done);
+}
+
+// Flush every inode with delayed blocks.
+static void
+iflushall(void)
+{
+  struct inode *ip;
+
+  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
+    if(__atomic_load_n(&ip->ndelay, __ATOMIC_RELAXED) == 0 || !iget_tryref(ip))
+      continue;
+    iflush(ip);
+    begin_op();
+    iput(ip);
+    end_op();
+  }
+}
+
+// the flusher thread.
+static void
+flush_thread(void)
+{
+  uint t0;
+
+  for(;;){
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < FLUSHTICKS &&
+          __atomic_load_n(&dpool.nused, __ATOMIC_RELAXED) <= NDELAY / 2 &&
+          __atomic_load_n(&dpool.ninode, __ATOMIC_RELAXED) < NDELAYINODE)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+    iflushall();
+  }
+}
+
+// for statistics.
+int
+delay_stats(char *buf, int sz)
+{
+  return snprintf(buf, sz, "--- delalloc: used %d flushed %d fallback %d\n",
+                  dpool.nused, (int)dpool.nflush, (int)dpool.nfallback);
+}
+#endif
+
 // Copy stat information from inode.
 // Caller must hold ip->lock.
 void
@@ -516,6 +1109,17 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    #ifdef riscv
+    struct dblock *d;
+    if(ip->ndelay && (d = dlookup(ip, off/BSIZE)) != 0){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      if(either_copyout(user_dst, dst, d->data + (off % BSIZE), m) == -1) {
+        tot = -1;
+        break;
+      }
+      continue;
+    }
+    #endif
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
@@ -531,6 +1135,54 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
+// Sequential readahead, called by fileread() before readi().
+// A read that starts where the previous one on the same open
+// file ended counts as sequential: the window starts at RAMIN
+// blocks past the end of the read and doubles, up to RAMAX, for
+// each further sequential read. Blocks in the window that have
+// not been read ahead yet are started without waiting. Any other
+// read closes the window.
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, struct rastate *ra, uint off, uint n)
+{
+  uint bn, end, last, addr, start, run;
+
+  if(off != ra->prev || off >= ip->size){
+    ra->prev = off + n;
+    ra->next = 0;
+    ra->win = 0;
+    return;
+  }
+  ra->prev = off + n;
+  ra->win = ra->win ? min(ra->win * 2, RAMAX) : RAMIN;
+
+  end = min(off + n, ip->size);
+  last = (end + BSIZE - 1) / BSIZE + ra->win;
+  if(last > (ip->size + BSIZE - 1) / BSIZE)
+    last = (ip->size + BSIZE - 1) / BSIZE;
+  bn = off / BSIZE;
+  if(bn < ra->next)
+    bn = ra->next;
+  // physically consecutive blocks are read ahead together.
+  // delayed blocks have no disk block to read.
+  for(start = run = 0; bn < last; bn++){
+    if((addr = bpeek(ip, bn)) == 0)
+      break;
+    if(run > 0 && addr == start + run){
+      run++;
+      continue;
+    }
+    if(run > 0)
+      breadahead(ip->dev, start, run);
+    start = addr;
+    run = 1;
+  }
+  if(run > 0)
+    breadahead(ip->dev, start, run);
+  ra->next = bn;
+}
+
 // Write data to inode.
 // Caller must hold ip->lock.
 // If user_src==1, then src is a user virtual address;
@@ -543,6 +1195,7 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  int ondisk = 0;
 
   if(off > ip->size || off + n < off)
     return -1;
@@ -550,6 +1203,16 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
     return -1;
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    #ifdef riscv
+    struct dblock *d;
+    if(ip->type == T_FILE && (d = dget(ip, off/BSIZE)) != 0){
+      m = min(n - tot, BSIZE - off%BSIZE);
+      if(either_copyin(d->data + (off % BSIZE), user_src, src, m) == -1)
+        break;
+      continue;
+    }
+    #endif
+    ondisk = 1;
     uint addr = bmap(ip, off/BSIZE);
     if(addr == 0)
       break;
@@ -559,6 +1222,12 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
       brelse(bp);
       break;
     }
+    #ifdef riscv
+    // directory contents are metadata, and stay in the log.
+    if(ip->type == T_FILE)
+      log_data(bp);
+    else
+    #endif
     log_write(bp);
     brelse(bp);
   }
@@ -568,8 +1237,10 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
-  // block to ip->addrs[].
-  iupdate(ip);
+  // block to ip->addrs[]. Delayed blocks alone change nothing on
+  // disk until they are flushed.
+  if(ondisk)
+    iupdate(ip);
 
   return tot;
 }
@@ -26,6 +26,34 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// On riscv the commit itself is done by a kernel thread, logd:
+// end_op() only wakes it, and returns without waiting. logd
+// commits once no FS system calls are active, so everything that
+// ended meanwhile, from any number of processes, goes into one
+// commit (group commit). log_force() waits for it, for callers
+// that need the data on disk (fsync()).
+//
+// The riscv log is also split into up to NLOGREGION regions, each
+// with its own header. When logd closes a transaction it copies
+// the logged blocks into shadow bufs of a free region; new FS
+// system calls can begin as soon as that copy is done, and build
+// the next transaction while logd writes and installs the old one
+// from the shadows. The regions are installed in the order they
+// were committed; recovery replays them by sequence number.
+//
+// A riscv header also carries a checksum over itself and its
+// log blocks, so the header and the blocks go to disk together
+// in one pass: a torn commit fails the check and recovery skips
+// it. Headers are never cleared; instead each records the last
+// transaction installed when it was written, and recovery skips
+// everything up to that.
+//
+// Only metadata is logged on riscv. File data blocks are passed
+// to log_data() instead: they are written straight to their home
+// locations before the transaction that allocated them commits
+// (ordered data), so a write no longer has to fit its data in the
+// log, and the data is written once.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -40,8 +68,30 @@
 struct logheader {
   int n;
   int block[MYLOGBLOCKS];
+  uint seq;        // riscv: transaction number, orders the regions
+  uint installed;  // riscv: last transaction installed at commit
+  uint sum;        // riscv: logsum() of the header and log blocks
 };
 
+#ifdef riscv
+// a bit per disk block, for the blocks a transaction freed.
+#define FREEWORDS ((FSSIZE + 63) / 64)
+
+// One header block followed by MYLOGBLOCKS log blocks.
+// shadow[i] holds block lh.block[i] as it was when the
+// transaction closed, and hdr the header block; the shadows
+// are not in the bcache.
+struct logregion {
+  int start;
+  struct logheader lh;
+  struct buf *hdr;
+  struct buf *shadow[MYLOGBLOCKS];
+  int ndata;
+  uint data[LOGDATABLOCKS];  // ordered data blocks
+  uint64 freed[FREEWORDS];   // blocks freed, see log_free()
+};
+#endif
+
 struct log {
   struct spinlock lock;
   int start;
@@ -49,14 +99,36 @@ struct log {
   int size;
   #endif
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int committing;  // in commit(), please wait. riscv: copying to shadows
   int dev;
   struct logheader lh;
+  #ifdef riscv
+  uint64 seq;      // number of the transaction being built
+  uint64 done;     // last transaction committed
+  uint64 nops;     // FS sys calls ended
+  uint64 ncommit;
+  int nregion;
+  int oldest;      // oldest region not yet installed
+  int nbusy;       // regions committed and not yet installed
+  uint64 installed; // last transaction installed
+  int ndata;       // ordered data blocks of the open transaction
+  uint data[LOGDATABLOCKS];
+  uint64 freed[FREEWORDS]; // blocks freed by the open transaction
+  uint64 nlogged;  // blocks written to the log
+  uint64 ndatablk; // ordered data blocks written
+  struct logregion region[NLOGREGION];
+  #endif
 };
 struct log log;
 
 static void recover_from_log(void);
+#ifdef loongarch
 static void commit();
+#endif
+#ifdef riscv
+static void log_thread(void);
+static struct buf *shadowalloc(void);
+#endif
 
 void
 initlog(int dev, struct superblock *sb)
@@ -70,29 +142,173 @@ initlog(int dev, struct superblock *sb)
   log.size = sb->nlog;
   #endif
   log.dev = dev;
+  #ifdef riscv
+  // an old image with a single-region log still works.
+  log.nregion = sb->nlog / (MYLOGBLOCKS+1);
+  if(log.nregion > NLOGREGION)
+    log.nregion = NLOGREGION;
+  if(log.nregion < 1)
+    panic("initlog: log too small");
+  for(int r = 0; r < log.nregion; r++){
+    log.region[r].start = log.start + r*(MYLOGBLOCKS+1);
+    log.region[r].hdr = shadowalloc();
+    for(int i = 0; i < MYLOGBLOCKS; i++)
+      log.region[r].shadow[i] = shadowalloc();
+  }
+  #endif
   recover_from_log();
+  #ifdef riscv
+  if(kthread_create("logd", log_thread) < 0)
+    panic("initlog: logd");
+  #endif
+}
+
+#ifdef riscv
+// bufs for the shadow copies, carved out of kalloc() pages
+// like the bcache's.
+static struct buf*
+shadowalloc(void)
+{
+  static char *page;
+  static int left;
+  struct buf *b;
+
+  if(left == 0){
+    if((page = kalloc()) == 0)
+      panic("initlog: shadow");
+    left = PGSIZE / sizeof(struct buf);
+  }
+  b = (struct buf *)page;
+  page += sizeof(struct buf);
+  left--;
+  memset(b, 0, sizeof(*b));
+  initsleeplock(&b->lock, "logshadow");
+  b->dev = log.dev;
+  b->bucket = -1;
+  return b;
+}
+
+// FNV-1a over the header, with sum taken as 0, and the
+// header's n log blocks.
+static uint
+logsum(struct logheader *lh, struct buf **bs)
+{
+  uint h = 2166136261;
+  uint sum = lh->sum;
+  uchar *p;
+  int i, j;
+
+  lh->sum = 0;
+  p = (uchar *)lh;
+  for(i = 0; i < sizeof(*lh); i++)
+    h = (h ^ p[i]) * 16777619;
+  lh->sum = sum;
+  for(j = 0; j < lh->n; j++){
+    p = bs[j]->data;
+    for(i = 0; i < BSIZE; i++)
+      h = (h ^ p[i]) * 16777619;
+  }
+  return h;
+}
+
+// Copy a committed region from the log to the home locations,
+// through the cache: used only by recovery.
+static void
+replay(struct logregion *rg)
+{
+  struct buf *lbuf[MYLOGBLOCKS], *dbuf[MYLOGBLOCKS];
+  int tail;
+
+  printf("recovering seq %d: %d blocks\n", rg->lh.seq, rg->lh.n);
+  bread_multi(log.dev, rg->start+1, rg->lh.n, lbuf);
+  for (tail = 0; tail < rg->lh.n; tail++) {
+    dbuf[tail] = bread(log.dev, rg->lh.block[tail]);
+    memmove(dbuf[tail]->data, lbuf[tail]->data, BSIZE);
+  }
+  bwrite_multi(dbuf, rg->lh.n);
+  for (tail = 0; tail < rg->lh.n; tail++) {
+    brelse(lbuf[tail]);
+    brelse(dbuf[tail]);
+  }
+}
+
+// Read a region's header, and check it and its log blocks
+// against the checksum. Returns 0 if the region holds no
+// transaction or a torn one.
+static int
+read_head(struct logregion *rg)
+{
+  struct buf *buf, *lbuf[MYLOGBLOCKS];
+  int ok;
+
+  buf = bread(log.dev, rg->start);
+  memmove(&rg->lh, buf->data, sizeof(rg->lh));
+  brelse(buf);
+  if(rg->lh.n <= 0 || rg->lh.n > MYLOGBLOCKS)
+    return 0;
+  bread_multi(log.dev, rg->start+1, rg->lh.n, lbuf);
+  ok = logsum(&rg->lh, lbuf) == rg->lh.sum;
+  for(int i = 0; i < rg->lh.n; i++)
+    brelse(lbuf[i]);
+  if(!ok)
+    printf("log: seq %d torn, ignored\n", rg->lh.seq);
+  return ok;
 }
 
-// Copy committed blocks from log to their home location
+// Replay the valid transactions not yet installed, oldest
+// first. New transactions go on from the newest one, into
+// the region after it.
+static void
+recover_from_log(void)
+{
+  struct logregion *rg, *order[NLOGREGION];
+  uint installed = 0, last = 0;
+  int n = 0, i;
+
+  for(int r = 0; r < log.nregion; r++){
+    rg = &log.region[r];
+    if(!read_head(rg))
+      continue;
+    if(rg->lh.installed > installed)
+      installed = rg->lh.installed;
+    if(rg->lh.seq > last){
+      last = rg->lh.seq;
+      log.oldest = (r + 1) % log.nregion;
+    }
+    for(i = n++; i > 0 && order[i-1]->lh.seq > rg->lh.seq; i--)
+      order[i] = order[i-1];
+    order[i] = rg;
+  }
+  for(i = 0; i < n; i++)
+    if(order[i]->lh.seq > installed)
+      replay(order[i]);
+  log.seq = last + 1;
+  log.done = last;
+  log.installed = last;
+}
+#endif
+
+#ifdef loongarch
+// Copy committed blocks from log to their home location.
+// The log is read in one go, and the home blocks are written
+// together, runs of consecutive ones as single disk requests.
 static void
 install_trans(int recovering)
 {
+  struct buf *lbuf[MYLOGBLOCKS], *dbuf[MYLOGBLOCKS];
   int tail;
 
+  bread_multi(log.dev, log.start+1, log.lh.n, lbuf); // read log blocks
+  for (tail = 0; tail < log.lh.n; tail++) {
+    dbuf[tail] = bread(log.dev, log.lh.block[tail]); // read dst
+    memmove(dbuf[tail]->data, lbuf[tail]->data, BSIZE);  // copy block to dst
+  }
+  bwrite_multi(dbuf, log.lh.n);  // write dst to disk
   for (tail = 0; tail < log.lh.n; tail++) {
-    #ifdef riscv
-    if(recovering) {
-      printf("recovering tail %d dst %d\n", tail, log.lh.block[tail]);
-    }
-    #endif
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
     if(recovering == 0)
-      bunpin(dbuf);
-    brelse(lbuf);
-    brelse(dbuf);
+      bunpin(dbuf[tail]);
+    brelse(lbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -136,6 +352,8 @@ recover_from_log(void)
   write_head(); // clear the log
 }
 
+#endif
+
 // called at the start of each FS system call.
 void
 begin_op(void)
@@ -147,6 +365,11 @@ begin_op(void)
     } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > MYLOGBLOCKS){
       // this op might exhaust log space; wait for commit.
       sleep(&log, &log.lock);
+    #ifdef riscv
+    } else if(log.ndata + (log.outstanding+1)*OPDATABLOCKS > LOGDATABLOCKS){
+      // the same for ordered data blocks.
+      sleep(&log, &log.lock);
+    #endif
     } else {
       log.outstanding += 1;
       release(&log.lock);
@@ -155,6 +378,224 @@ begin_op(void)
   }
 }
 
+#ifdef riscv
+// called at the end of each FS system call.
+// if this was the last outstanding operation, wakes logd
+// to commit.
+void
+end_op(void)
+{
+  acquire(&log.lock);
+  log.outstanding -= 1;
+  log.nops++;
+  if(log.committing)
+    panic("log.committing");
+  if(log.outstanding == 0){
+    wakeup(&log.seq);
+  } else {
+    // begin_op() may be waiting for log space,
+    // and decrementing log.outstanding has decreased
+    // the amount of reserved space.
+    wakeup(&log);
+  }
+  release(&log.lock);
+}
+
+// Copy the blocks of a closing transaction from the cache into
+// the region's shadows. Runs with log.committing set, so no FS
+// system call can change them meanwhile.
+static void
+snapshot(struct logregion *rg)
+{
+  struct buf *from;
+
+  for(int i = 0; i < rg->lh.n; i++){
+    from = bread(log.dev, rg->lh.block[i]);
+    memmove(rg->shadow[i]->data, from->data, BSIZE);
+    brelse(from);
+  }
+  rg->ndata = log.ndata;
+  memmove(rg->data, log.data, log.ndata * sizeof(uint));
+  memmove(rg->freed, log.freed, sizeof(log.freed));
+  memset(log.freed, 0, sizeof(log.freed));
+}
+
+// Write the transaction's data blocks home from the cache, in
+// block order, and unpin them.
+static void
+write_data(struct logregion *rg)
+{
+  struct buf *bs[32];
+  uint t;
+  int i, j, n;
+
+  for(i = 1; i < rg->ndata; i++){
+    t = rg->data[i];
+    for(j = i; j > 0 && rg->data[j-1] > t; j--)
+      rg->data[j] = rg->data[j-1];
+    rg->data[j] = t;
+  }
+  for(i = 0; i < rg->ndata; i += n){
+    n = rg->ndata - i;
+    if(n > NELEM(bs))
+      n = NELEM(bs);
+    for(j = 0; j < n; j++)
+      bs[j] = bread(log.dev, rg->data[i+j]);
+    bwrite_multi(bs, n);
+    for(j = 0; j < n; j++){
+      bunpin(bs[j]);
+      brelse(bs[j]);
+    }
+  }
+}
+
+// Write the header and the shadows to the region in one go;
+// the checksum makes the transaction valid only if all of it
+// reached the disk.
+static void
+commit_region(struct logregion *rg)
+{
+  struct buf *bs[MYLOGBLOCKS+1];
+
+  rg->lh.installed = log.installed;
+  rg->lh.sum = logsum(&rg->lh, rg->shadow);
+  memset(rg->hdr->data, 0, BSIZE);
+  memmove(rg->hdr->data, &rg->lh, sizeof(rg->lh));
+  rg->hdr->blockno = rg->start;
+  bs[0] = rg->hdr;
+  for(int i = 0; i < rg->lh.n; i++){
+    rg->shadow[i]->blockno = rg->start + 1 + i;
+    bs[i+1] = rg->shadow[i];
+  }
+  bwrite_multi(bs, rg->lh.n + 1);
+}
+
+// Write the shadows to their home locations, bypassing the cache,
+// whose copies may already hold a later transaction's changes.
+// Then unpin the cache copies; the region can be reused.
+static void
+install_region(struct logregion *rg)
+{
+  struct buf *b;
+
+  for(int i = 0; i < rg->lh.n; i++)
+    rg->shadow[i]->blockno = rg->lh.block[i];
+  bwrite_multi(rg->shadow, rg->lh.n);
+  for(int i = 0; i < rg->lh.n; i++){
+    b = bread(log.dev, rg->lh.block[i]);
+    bunpin(b);
+    brelse(b);
+  }
+}
+
+// Install the oldest committed region and free it.
+static void
+install_oldest(void)
+{
+  struct logregion *rg = &log.region[log.oldest];
+
+  install_region(rg);
+
+  acquire(&log.lock);
+  log.installed = rg->lh.seq;
+  log.oldest = (log.oldest + 1) % log.nregion;
+  log.nbusy--;
+  release(&log.lock);
+}
+
+// the log thread: close the transaction into a free region
+// whenever there is something logged and no FS system call is
+// in progress, and commit it; otherwise install the oldest
+// committed region.
+static void
+log_thread(void)
+{
+  struct logregion *rg;
+
+  // the shadows are only ever used here.
+  for(int r = 0; r < log.nregion; r++){
+    acquiresleep(&log.region[r].hdr->lock);
+    for(int i = 0; i < MYLOGBLOCKS; i++)
+      acquiresleep(&log.region[r].shadow[i]->lock);
+  }
+
+  acquire(&log.lock);
+  for(;;){
+    if(log.outstanding == 0 && (log.lh.n > 0 || log.ndata > 0) &&
+       log.nbusy < log.nregion){
+      rg = &log.region[(log.oldest + log.nbusy) % log.nregion];
+      rg->lh = log.lh;
+      rg->lh.seq = log.seq;
+      log.nbusy++;
+      log.committing = 1;
+      release(&log.lock);
+
+      snapshot(rg);
+
+      acquire(&log.lock);
+      log.lh.n = 0;
+      log.ndata = 0;
+      log.committing = 0;
+      log.seq++;
+      wakeup(&log);
+      release(&log.lock);
+
+      if(rg->ndata > 0){
+        // an older transaction may still have to install a block
+        // that has since been freed and reused for this one's data.
+        while(log.nbusy > 1)
+          install_oldest();
+        write_data(rg);
+      }
+      commit_region(rg);
+      // the committed metadata no longer refers to the blocks
+      // this transaction freed.
+      balloc_release(log.dev, rg->freed);
+
+      acquire(&log.lock);
+      log.done = rg->lh.seq;
+      log.ncommit++;
+      log.nlogged += rg->lh.n;
+      log.ndatablk += rg->ndata;
+      wakeup(&log);
+    } else if(log.nbusy > 0){
+      release(&log.lock);
+      install_oldest();
+      acquire(&log.lock);
+    } else {
+      sleep(&log.seq, &log.lock);
+    }
+  }
+}
+
+// wait until every FS system call that has ended so far
+// is on disk.
+void
+log_force(void)
+{
+  uint64 target;
+
+  acquire(&log.lock);
+  if(log.committing || log.lh.n > 0 || log.ndata > 0)
+    target = log.seq;
+  else
+    target = log.seq - 1;  // the last one closed
+  while(log.done < target)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
+// for statistics.
+int
+log_stats(char *buf, int sz)
+{
+  return snprintf(buf, sz, "--- log: ops %d commits %d logged %d data %d\n",
+                  (int)log.nops, (int)log.ncommit, (int)log.nlogged,
+                  (int)log.ndatablk);
+}
+#endif
+
+#ifdef loongarch
 // called at the end of each FS system call.
 // commits if this was the last outstanding operation.
 void
@@ -187,21 +628,27 @@ end_op(void)
     release(&log.lock);
   }
 }
+#endif
 
+#ifdef loongarch
 // Copy modified blocks from cache to log.
+// The log blocks are consecutive, so they go out as a few
+// large disk requests.
 static void
 write_log(void)
 {
+  struct buf *to[MYLOGBLOCKS];
   int tail;
 
+  bread_multi(log.dev, log.start+1, log.lh.n, to); // log blocks
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(to[tail]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
   }
+  bwrite_multi(to, log.lh.n);  // write the log
+  for (tail = 0; tail < log.lh.n; tail++)
+    brelse(to[tail]);
 }
 
 static void
@@ -215,6 +662,7 @@ commit()
     write_head();    // Erase the transaction from the log
   }
 }
+#endif
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
@@ -254,3 +702,45 @@ log_write(struct buf *b)
   release(&log.lock);
 }
 
+#ifdef riscv
+// Caller has modified b->data, a file data block, and is done
+// with the buffer. Like log_write(), but the block is not logged:
+// logd writes it to its home location before the transaction
+// commits.
+void
+log_data(struct buf *b)
+{
+  int i;
+
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+
+  for (i = 0; i < log.ndata; i++) {
+    if (log.data[i] == b->blockno)
+      break;
+  }
+  if (i == log.ndata) {
+    if (log.ndata >= LOGDATABLOCKS)
+      panic("too much data in a transaction");
+    log.data[log.ndata++] = b->blockno;
+    bpin(b);
+  }
+  release(&log.lock);
+}
+
+// Block b was freed by the open transaction. Remember it, so that
+// logd can let the allocator have it back (balloc_release()) once
+// the transaction has committed.
+void
+log_free(uint b)
+{
+  acquire(&log.lock);
+  if (log.outstanding < 1)
+    panic("log_free outside of trans");
+  if (b >= FREEWORDS * 64)
+    panic("log_free");
+  log.freed[b / 64] |= 1UL << (b % 64);
+  release(&log.lock);
+}
+#endif
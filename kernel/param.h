@@ -1,5 +1,4 @@
 #ifdef riscv
-#define NPROC        64  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
 #endif
 #ifdef loongarch
@@ -14,7 +13,17 @@
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define MYLOGBLOCKS    (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define NLOGREGION    3  // riscv: log regions, each MYLOGBLOCKS+1 blocks
+#define OPDATABLOCKS 64  // riscv: max file data blocks any FS op writes
+#define LOGDATABLOCKS (OPDATABLOCKS*4) // riscv: max data blocks in a transaction
+#define NDELAY      512  // riscv: max file blocks waiting for allocation
+#define NDELAYINODE   6  // riscv: max inodes with blocks waiting for allocation
+#define FLUSHTICKS   10  // riscv: flusher period, in timer ticks
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define BCACHE_PCT   10               // bcache grows to this % of free memory
+#define MAXRUNBLOCKS  8  // max blocks in one disk request
+#define RAMIN         4  // initial readahead window, in blocks
+#define RAMAX        32  // maximum readahead window, in blocks
 #define FSSIZE       2000  // size of file system in blocks
 #define MAXPATH      128   // maximum file path name
 #define USERSTACK    1     // user stack pages
@@ -14,6 +14,12 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+// 持有者正在运行时最多自旋多少次再睡眠
+#define SLEEPLOCK_SPIN 10000
+
+// 有竞争的 acquiresleep() 中，自旋等到锁的次数和睡眠的次数
+static uint64 nspin, nsleep;
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
@@ -21,16 +27,36 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->owner = 0;
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
+  struct proc *owner;
+  int contended = 0;
+
+  // 持有者正在别的 hart 上运行时，锁通常很快就会释放：先不加锁地
+  // 观察一会儿，省掉 sleep() 和两次上下文切换。持有者不在运行
+  // （睡在磁盘 I/O 上或被换下）就直接去睡。struct proc 不会被释放，
+  // 读到过时的 owner 也是安全的。
+  for(int i = 0; i < SLEEPLOCK_SPIN && __atomic_load_n(&lk->locked, __ATOMIC_RELAXED); i++){
+    contended = 1;
+    owner = __atomic_load_n(&lk->owner, __ATOMIC_RELAXED);
+    if(owner && __atomic_load_n(&owner->state, __ATOMIC_RELAXED) != RUNNING)
+      break;
+  }
+
   acquire(&lk->lk);
+  if(lk->locked)
+    __sync_fetch_and_add(&nsleep, 1);
+  else if(contended)
+    __sync_fetch_and_add(&nspin, 1);
   while (lk->locked) {
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
+  lk->owner = myproc();
   lk->pid = myproc()->pid;
   release(&lk->lk);
 }
@@ -40,6 +66,7 @@ releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
   lk->locked = 0;
+  lk->owner = 0;
   lk->pid = 0;
   wakeup(lk);
   release(&lk->lk);
@@ -51,10 +78,14 @@ holdingsleep(struct sleeplock *lk)
   int r;
   
   acquire(&lk->lk);
-  r = lk->locked && (lk->pid == myproc()->pid);
+  r = lk->locked && (lk->owner == myproc());
   release(&lk->lk);
   return r;
 }
 
-
-
+void
+sleeplock_counts(uint64 *spin, uint64 *slept)
+{
+  *spin = nspin;
+  *slept = nsleep;
+}
@@ -17,7 +17,12 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz) // both tests needed, in case of overflow
+  #ifdef riscv
+  uint64 sz = p->mm->sz;
+  #else
+  uint64 sz = p->sz;
+  #endif
+  if(addr >= sz || addr+sizeof(uint64) > sz) // both tests needed, in case of overflow
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -129,6 +134,21 @@ extern uint64 sys_pause(void);
 extern uint64 sys_trace(void);
 extern uint64 sys_sysinfo(void);
 
+// 调度
+extern uint64 sys_times(void);
+extern uint64 sys_setpriority(void);
+extern uint64 sys_getpriority(void);
+extern uint64 sys_sched_setscheduler(void);
+extern uint64 sys_sched_getscheduler(void);
+extern uint64 sys_sched_yield(void);
+
+// 线程
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex(void);
+extern uint64 sys_wait4(void);
+extern uint64 sys_getppid(void);
+
 // page table
 extern uint64 sys_kpgtbl(void);
 
@@ -149,6 +169,12 @@ extern uint64 sys_shmget(void);
 extern uint64 sys_shmat(void);
 extern uint64 sys_shmdt(void);
 extern uint64 sys_shmctl(void);
+
+extern uint64 sys_fsync(void);
+
+// 磁盘轮询模式和延迟测试
+extern uint64 sys_diskpoll(void);
+extern uint64 sys_disklat(void);
 #endif
 
 #ifdef loongarch
@@ -185,6 +211,21 @@ static uint64 (*syscalls[])(void) = {
 [SYS_trace]   sys_trace,
 [SYS_sysinfo] sys_sysinfo,
 
+// 调度
+[SYS_times]   sys_times,
+[SYS_setpriority] sys_setpriority,
+[SYS_getpriority] sys_getpriority,
+[SYS_sched_setscheduler] sys_sched_setscheduler,
+[SYS_sched_getscheduler] sys_sched_getscheduler,
+[SYS_sched_yield] sys_sched_yield,
+
+// 线程
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex]   sys_futex,
+[SYS_wait4]   sys_wait4,
+[SYS_getppid] sys_getppid,
+
 // LAB_PGTBL
 [SYS_kpgtbl]  sys_kpgtbl,
 
@@ -197,6 +238,7 @@ static uint64 (*syscalls[])(void) = {
 // LAB_LOCK
 [SYS_rwlktest] sys_rwlktest,
 [SYS_cpupin] sys_cpupin,
+[SYS_lockbench] sys_lockbench,
 
 [SYS_mmap] sys_mmap,
 [SYS_munmap] sys_munmap,
@@ -206,6 +248,12 @@ static uint64 (*syscalls[])(void) = {
 [SYS_shmat] sys_shmat,
 [SYS_shmdt] sys_shmdt,
 [SYS_shmctl] sys_shmctl,
+
+[SYS_fsync]  sys_fsync,
+
+// 磁盘轮询模式和延迟测试
+[SYS_diskpoll] sys_diskpoll,
+[SYS_disklat] sys_disklat,
 #endif
 #ifdef loongarch
 [SYS_sleep]   sys_sleep,
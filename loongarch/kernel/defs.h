@@ -1,9 +1,11 @@
 struct buf;
+struct bcache_stat;
 struct context;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct rastate;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -31,6 +33,7 @@ void            pop_off(void);
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            sleeplock_counts(uint64*, uint64*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -120,6 +123,12 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bcache_shrink(int);
+void            bcache_stat(struct bcache_stat*);
+void            breadahead(uint, uint, int);
+void            bread_multi(uint, uint, int, struct buf**);
+void            bwrite_multi(struct buf**, int);
+void            bio_readdone(struct buf*);
 
 // log.c
 void            initlog(int, struct superblock*);
@@ -143,6 +152,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            ireadahead(struct inode*, struct rastate*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
@@ -5,4 +5,5 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+  struct proc *owner; // 持有者，acquiresleep() 据此决定自旋还是睡眠
 };
\ No newline at end of file
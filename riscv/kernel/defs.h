@@ -1,9 +1,11 @@
 struct buf;
+struct bcache_stat;
 struct context;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct rastate;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -19,6 +21,12 @@ void            brelse(struct buf*);
 void            bwrite(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+int             bcache_shrink(int);
+void            bcache_stat(struct bcache_stat*);
+void            breadahead(uint, uint, int);
+void            bread_multi(uint, uint, int, struct buf**);
+void            bwrite_multi(struct buf**, int);
+void            bio_readdone(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -53,10 +61,18 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, int, uint64, uint, uint);
+void            ireadahead(struct inode*, struct rastate*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
 void            ireclaim(int);
+void            iflush(struct inode*);
+int             delay_stats(char*, int);
+uint            balloc_range(uint, uint, int, int*);
+int             balloc_nfree(void);
+int             balloc_npend(void);
+void            balloc_release(int, uint64*);
+int             balloc_stats(char*, int);
 
 // kalloc.c
 void*           kalloc(void);
@@ -70,8 +86,12 @@ void            dec_refcnt(void *);
 // log.c
 void            initlog(int, struct superblock*);
 void            log_write(struct buf*);
+void            log_data(struct buf*);
+void            log_free(uint);
 void            begin_op(void);
 void            end_op(void);
+void            log_force(void);
+int             log_stats(char*, int);
 
 // pipe.c
 int             pipealloc(struct file**, struct file**);
@@ -90,10 +110,19 @@ int             cpuid(void);
 void            kexit(int);
 int             kfork(void);
 int             growproc(int);
-void            proc_mapstacks(pagetable_t);
+uint64          growproc_lazy(int);
+int             kclone(uint64, uint64, uint64);
+int             kjoin(int, uint64);
+void            setcwd(struct inode*);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
+int             forkcache_drain(void);
 int             kkill(int);
+int             setnice(int, int);
+int             getnice(int);
+int             setscheduler(int, int, int);
+int             getscheduler(int);
+int             need_resched(void);
 int             killed(struct proc*);
 void            setkilled(struct proc*);
 struct cpu*     mycpu(void);
@@ -103,7 +132,9 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            sleep(void*, struct spinlock*);
 void            userinit(void);
-int             kwait(uint64);
+int             kthread_create(char*, void (*)(void));
+int             kwait(int, uint64, int);
+int             getppid(void);
 void            wakeup(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
@@ -123,19 +154,20 @@ void            push_off(void);
 void            pop_off(void);
 int				atomic_read4(int *addr);
 // LAB_LOCK
-void            freelock(struct spinlock*);
 void            initrwlock(struct rwspinlock*);
 void            read_acquire(struct rwspinlock*);
 void            read_release(struct rwspinlock*);
 void            write_acquire(struct rwspinlock*);
 void            write_release(struct rwspinlock*);
 uint64          sys_rwlktest(void);
+uint64          sys_lockbench(void);
 // END LAB_LOCK
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+void            sleeplock_counts(uint64*, uint64*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -181,6 +213,8 @@ uint64          uvmalloc(pagetable_t, uint64, uint64, int);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
 void            uvmfree(pagetable_t, uint64);
+void            uvmstrip(pagetable_t);
+void            freewalk(pagetable_t);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
 pte_t *         walk(pagetable_t, uint64, int);
@@ -199,10 +233,21 @@ void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
 
+// iosched.c
+void            iosched_init(void);
+int             iosched_submit_multi(struct buf **, int, int, void (*)(struct buf *));
+void            iosched_rw(struct buf **, int, int);
+int             iosched_stats(char *, int);
+
 // virtio_disk.c
 void            virtio_disk_init(void);
 void            virtio_disk_rw(struct buf *, int);
 void            virtio_disk_intr(void);
+int             virtio_disk_submit(struct buf *, int, void (*)(struct buf *));
+int             virtio_disk_submit_multi(struct buf **, int, int, void (*)(struct buf *));
+void            virtio_disk_rw_multi(struct buf **, int, int);
+void            virtio_disk_poll(struct buf **, int);
+int             virtio_disk_stats(char *, int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -232,6 +277,27 @@ void            statsinc(void);
 int             snprintf(char*, unsigned long, const char*, ...);
 // END LAB_LOCK
 
+// ipi.c
+void            ipi_send(int, int);
+void            ipi_intr(void);
+void            ipi_poll(void);
+int             ipi_kick(struct proc*);
+void            tlb_shootdown(pagetable_t);
+
+// futex.c
+void            futexinit(void);
+int             futex(uint64, int, int);
+
+// rcu.c
+struct rcu_head;
+void            rcuinit(void);
+void            rcu_read_lock(void);
+void            rcu_read_unlock(void);
+void            rcu_qs(void);
+void            rcu_sched(void);
+void            synchronize_rcu(void);
+void            call_rcu(struct rcu_head*, void (*)(struct rcu_head*));
+
 // shm.c
 void            shm_init(void);
 int             shmget(int key, int size, int shmflg);
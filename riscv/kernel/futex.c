@@ -0,0 +1,189 @@
+// Fast user-space mutexes.
+//
+// A futex is a 32-bit word in user memory. User code does the
+// uncontended work with atomic instructions and only enters the
+// kernel to sleep until the word changes (FUTEX_WAIT) or to wake
+// sleepers (FUTEX_WAKE).
+//
+// Waiters are keyed on the physical address of the word, so the
+// same futex is found through any mapping of it: by the threads of
+// one process, and by processes that attached the same shm segment.
+// Keys are hashed into NFUTEXBUCKET buckets; each waiter is a node
+// on its own kernel stack, linked into the bucket's list.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "futex.h"
+
+#define NFUTEXBUCKET 64
+
+struct futex_waiter {
+  uint64 key;                  // 物理地址
+  int woken;
+  struct futex_waiter *next;
+};
+
+struct futex_bucket {
+  struct spinlock lock;
+  struct futex_waiter *head;
+} futex_buckets[NFUTEXBUCKET];
+
+void
+futexinit(void)
+{
+  for(int i = 0; i < NFUTEXBUCKET; i++)
+    initlock(&futex_buckets[i].lock, "futex");
+}
+
+static struct futex_bucket *
+futex_bucket(uint64 key)
+{
+  // 低 2 位恒为 0；把页号也混进来，避免同一页内的相邻字
+  // 和不同页内相同偏移的字都挤到一个桶里。
+  return &futex_buckets[((key >> 2) ^ (key >> 12)) % NFUTEXBUCKET];
+}
+
+// Make sure the page holding uaddr is present and privately
+// writable, so its physical address is the one every future
+// access (and every other sharer) sees. Breaking a COW share here
+// matters: otherwise a waiter could key on the shared copy and a
+// later write would move the word to a different page.
+// Called without locks held; vmfault() and cow_handler() may sleep.
+static int
+futex_fault(struct proc *p, uint64 uaddr)
+{
+  pte_t *pte;
+
+  if(uaddr % 4 != 0 || uaddr >= p->mm->sz)
+    return -1;
+  pte = walk(p->pagetable, uaddr, 0);
+  if(pte == 0 || (*pte & PTE_V) == 0){
+    if(vmfault(p->pagetable, uaddr, 0) == 0)
+      return -1;
+    pte = walk(p->pagetable, uaddr, 0);
+  }
+  if((*pte & PTE_COW) && cow_handler(p->pagetable, uaddr) < 0)
+    return -1;
+  return 0;
+}
+
+// Translate uaddr to its key. The caller holds p->mm->lock, which
+// keeps growproc() from unmapping the page underneath us.
+// Returns 0 if the page went away since futex_fault().
+static uint64
+futex_key(struct proc *p, uint64 uaddr)
+{
+  pte_t *pte = walk(p->pagetable, uaddr, 0);
+
+  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_U) == 0)
+    return 0;
+  return PTE2PA(*pte) + (uaddr % PGSIZE);
+}
+
+// Sleep on uaddr if it still holds val. Checking the value and
+// queueing happen under the bucket lock, and FUTEX_WAKE takes the
+// same lock, so a wakeup between the user's check and our sleep
+// cannot be lost.
+// Returns 0 when woken, -1 if the value differed, the address is
+// bad, or the process was killed.
+static int
+futex_wait(uint64 uaddr, int val)
+{
+  struct proc *p = myproc();
+  struct futex_bucket *b;
+  struct futex_waiter w, **pp;
+  uint64 key;
+
+  if(futex_fault(p, uaddr) < 0)
+    return -1;
+
+  acquire(&p->mm->lock);
+  if((key = futex_key(p, uaddr)) == 0){
+    release(&p->mm->lock);
+    return -1;
+  }
+  b = futex_bucket(key);
+  acquire(&b->lock);
+  if(*(volatile int *)key != val){
+    release(&b->lock);
+    release(&p->mm->lock);
+    return -1;
+  }
+  release(&p->mm->lock);
+
+  w.key = key;
+  w.woken = 0;
+  w.next = b->head;
+  b->head = &w;
+  while(!w.woken && !killed(p))
+    sleep(&w, &b->lock);
+
+  if(!w.woken){
+    // killed: 自己从队列中摘下
+    for(pp = &b->head; *pp; pp = &(*pp)->next){
+      if(*pp == &w){
+        *pp = w.next;
+        break;
+      }
+    }
+  }
+  release(&b->lock);
+  return w.woken ? 0 : -1;
+}
+
+// Wake at most n waiters on uaddr. Returns the number woken.
+static int
+futex_wake(uint64 uaddr, int n)
+{
+  struct proc *p = myproc();
+  struct futex_bucket *b;
+  struct futex_waiter *w, **pp;
+  uint64 key;
+  int woken = 0;
+
+  if(futex_fault(p, uaddr) < 0)
+    return -1;
+
+  acquire(&p->mm->lock);
+  key = futex_key(p, uaddr);
+  release(&p->mm->lock);
+  if(key == 0)
+    return -1;
+
+  b = futex_bucket(key);
+  acquire(&b->lock);
+  // 新的等待者插在表头，从表尾唤醒才是先来先醒；桶里的
+  // 等待者很少，直接每次找最后一个匹配的节点。
+  while(woken < n){
+    struct futex_waiter **last = 0;
+    for(pp = &b->head; *pp; pp = &(*pp)->next)
+      if((*pp)->key == key)
+        last = pp;
+    if(last == 0)
+      break;
+    w = *last;
+    *last = w->next;
+    w->woken = 1;
+    wakeup(w);
+    woken++;
+  }
+  release(&b->lock);
+  return woken;
+}
+
+int
+futex(uint64 uaddr, int op, int val)
+{
+  switch(op & ~FUTEX_PRIVATE_FLAG){
+  case FUTEX_WAIT:
+    return futex_wait(uaddr, val);
+  case FUTEX_WAKE:
+    return futex_wake(uaddr, val);
+  }
+  return -1;
+}
@@ -0,0 +1,7 @@
+// futex(addr, op, val) 的操作码，与 Linux 相同
+#define FUTEX_WAIT 0   // 若 *addr == val 则睡眠，直到被 FUTEX_WAKE 唤醒
+#define FUTEX_WAKE 1   // 唤醒最多 val 个睡在 addr 上的进程
+
+// Linux 用来区分进程私有 futex 的标志。这里总是按物理地址
+// 匹配，忽略该标志。
+#define FUTEX_PRIVATE_FLAG 128
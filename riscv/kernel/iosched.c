@@ -0,0 +1,326 @@
+// Block I/O scheduler.
+//
+// Sits between the buffer cache and the virtio driver. Requests
+// are queued here and handed to the disk as it has room; the
+// elevator decides the order and merges queued requests for
+// consecutive blocks into one disk request.
+//
+// Two elevators, chosen at build time (make IOSCHED=):
+//   deadline (default): reads and writes sorted by block number
+//     and served in one-way sweeps, reads first; a request that
+//     has waited past its deadline, or writes that have been
+//     passed over WRITES_STARVED times, go next.
+//   noop: first come, first served; merges only with the request
+//     at the head of the queue.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "defs.h"
+#include "fs.h"
+#include "buf.h"
+
+#define MAXQUEUE 64         // async submitters back off past this many queued bufs
+#define READ_EXPIRE 500000  // deadlines, in r_time() ticks (10MHz): 50ms
+#define WRITE_EXPIRE 5000000 // 500ms
+#define WRITES_STARVED 4    // read batches before a pending write is served
+
+struct elevator {
+  char *name;
+  void (*add)(struct buf *b);               // queue b
+  struct buf *(*next)(void);                // the request to send next, dequeued
+  struct buf *(*take)(uint blockno, int write); // dequeue a request for blockno, if any
+  void (*requeue)(struct buf *b);           // undo next()/take(): b goes first again
+};
+
+// per-direction statistics.
+struct iostat {
+  uint64 nbuf;      // bufs transferred
+  uint64 nreq;      // disk requests they took
+  uint64 lat;       // total queue + disk time, in ticks
+  uint64 maxlat;
+  int depth;        // bufs queued or on the disk now
+  int maxdepth;
+};
+
+struct {
+  struct spinlock lock;
+  struct elevator *e;
+  int nqueued;          // bufs waiting in the elevator
+  uint pos;             // block after the last request sent
+  struct iostat st[2];  // [0] reads, [1] writes
+} ios;
+
+#ifdef IOSCHED_NOOP
+
+static struct buf *fifo, **fifotail = &fifo;
+
+static void
+noop_add(struct buf *b)
+{
+  b->qnext = 0;
+  *fifotail = b;
+  fifotail = &b->qnext;
+}
+
+static struct buf*
+noop_next(void)
+{
+  struct buf *b = fifo;
+
+  if(b && (fifo = b->qnext) == 0)
+    fifotail = &fifo;
+  return b;
+}
+
+static struct buf*
+noop_take(uint blockno, int write)
+{
+  if(fifo == 0 || fifo->blockno != blockno || fifo->iowrite != write)
+    return 0;
+  return noop_next();
+}
+
+static void
+noop_requeue(struct buf *b)
+{
+  if((b->qnext = fifo) == 0)
+    fifotail = &b->qnext;
+  fifo = b;
+}
+
+static struct elevator noop = { "noop", noop_add, noop_next, noop_take, noop_requeue };
+#define ELEVATOR noop
+
+#else
+
+// reads and writes, each sorted by block number.
+static struct buf *sorted[2];
+static int starved;     // read batches sent while writes waited
+
+static void
+deadline_add(struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &sorted[b->iowrite]; *pp && (*pp)->blockno < b->blockno; pp = &(*pp)->qnext)
+    ;
+  b->qnext = *pp;
+  *pp = b;
+}
+
+static void
+deadline_unlink(struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp = &sorted[b->iowrite]; *pp != b; pp = &(*pp)->qnext)
+    ;
+  *pp = b->qnext;
+}
+
+// the request of direction dir that has waited longest.
+static struct buf*
+oldest(int dir)
+{
+  struct buf *b, *o = 0;
+
+  for(b = sorted[dir]; b; b = b->qnext)
+    if(o == 0 || b->iotime < o->iotime)
+      o = b;
+  return o;
+}
+
+static struct buf*
+deadline_next(void)
+{
+  static const uint64 expire[2] = { READ_EXPIRE, WRITE_EXPIRE };
+  uint64 now = r_time();
+  struct buf *b;
+  int dir;
+
+  // an expired request goes first, reads before writes.
+  for(dir = 0; dir < 2; dir++){
+    if((b = oldest(dir)) != 0 && now - b->iotime > expire[dir]){
+      deadline_unlink(b);
+      return b;
+    }
+  }
+
+  if(sorted[0] && (sorted[1] == 0 || starved < WRITES_STARVED)){
+    dir = 0;
+    if(sorted[1])
+      starved++;
+  } else if(sorted[1]){
+    dir = 1;
+    starved = 0;
+  } else {
+    return 0;
+  }
+
+  // one-way sweep: the first block at or after the head position,
+  // or back to the lowest.
+  for(b = sorted[dir]; b && b->blockno < ios.pos; b = b->qnext)
+    ;
+  if(b == 0)
+    b = sorted[dir];
+  deadline_unlink(b);
+  return b;
+}
+
+static struct buf*
+deadline_take(uint blockno, int write)
+{
+  struct buf *b;
+
+  for(b = sorted[write]; b && b->blockno < blockno; b = b->qnext)
+    ;
+  if(b == 0 || b->blockno != blockno)
+    return 0;
+  deadline_unlink(b);
+  return b;
+}
+
+// the queues are sorted, so putting b back where it was is just add.
+static struct elevator deadline = { "deadline", deadline_add, deadline_next, deadline_take, deadline_add };
+#define ELEVATOR deadline
+
+#endif
+
+static void iosched_done(struct buf *b);
+
+void
+iosched_init(void)
+{
+  initlock(&ios.lock, "iosched");
+  ios.e = &ELEVATOR;
+}
+
+static void
+enqueue(struct buf *b, int write, void (*done)(struct buf *))
+{
+  struct iostat *st = &ios.st[write];
+
+  b->iowrite = write;
+  b->iodone = done;
+  b->iopending = 1;
+  b->iotime = r_time();
+  ios.e->add(b);
+  ios.nqueued++;
+  if(++st->depth > st->maxdepth)
+    st->maxdepth = st->depth;
+}
+
+// send queued requests to the disk while it has room,
+// merging consecutive blocks. caller holds ios.lock.
+static void
+dispatch(void)
+{
+  struct buf *run[MAXRUNBLOCKS], *b;
+  int n;
+
+  while((b = ios.e->next()) != 0){
+    run[0] = b;
+    for(n = 1; n < MAXRUNBLOCKS; n++)
+      if((run[n] = ios.e->take(run[n-1]->blockno + 1, b->iowrite)) == 0)
+        break;
+    if(virtio_disk_submit_multi(run, n, b->iowrite, iosched_done) < 0){
+      // the disk is full; iosched_done() will call again.
+      // put the run back last block first, so the queue is
+      // as it was before next().
+      while(n > 0)
+        ios.e->requeue(run[--n]);
+      return;
+    }
+    ios.nqueued -= n;
+    ios.pos = run[n-1]->blockno + 1;
+    ios.st[b->iowrite].nreq++;
+  }
+}
+
+// called by the disk driver, without its lock, for each buf
+// of a finished request.
+static void
+iosched_done(struct buf *b)
+{
+  struct iostat *st;
+  uint64 lat;
+  void (*done)(struct buf *);
+
+  acquire(&ios.lock);
+  st = &ios.st[b->iowrite];
+  lat = r_time() - b->iotime;
+  st->nbuf++;
+  st->lat += lat;
+  if(lat > st->maxlat)
+    st->maxlat = lat;
+  st->depth--;
+  done = b->iodone;
+  b->iopending = 0;
+  if(done == 0)
+    wakeup(b);
+  dispatch();
+  release(&ios.lock);
+
+  if(done)
+    done(b);
+}
+
+// queue the n locked bufs bs[] for a transfer without waiting.
+// done(b) is called for each when it finishes. returns -1,
+// queueing nothing, if too much is queued already.
+int
+iosched_submit_multi(struct buf **bs, int n, int write, void (*done)(struct buf *))
+{
+  acquire(&ios.lock);
+  if(ios.nqueued + n > MAXQUEUE){
+    release(&ios.lock);
+    return -1;
+  }
+  for(int i = 0; i < n; i++)
+    enqueue(bs[i], write, done);
+  dispatch();
+  release(&ios.lock);
+  return 0;
+}
+
+// transfer the n locked bufs bs[] and wait for all of them.
+void
+iosched_rw(struct buf **bs, int n, int write)
+{
+  acquire(&ios.lock);
+  for(int i = 0; i < n; i++)
+    enqueue(bs[i], write, 0);
+  dispatch();
+  release(&ios.lock);
+
+  // polled completion, if turned on (diskpoll()).
+  virtio_disk_poll(bs, n);
+
+  acquire(&ios.lock);
+  for(int i = 0; i < n; i++)
+    while(bs[i]->iopending)
+      sleep(bs[i], &ios.lock);
+  release(&ios.lock);
+}
+
+// for statistics: one line per direction.
+int
+iosched_stats(char *buf, int sz)
+{
+  struct iostat *st;
+  int n = 0;
+
+  for(int dir = 0; dir < 2; dir++){
+    st = &ios.st[dir];
+    n += snprintf(buf+n, sz-n,
+                  "--- iosched %s %s: bufs %d reqs %d avg-us %d max-us %d depth %d max-depth %d\n",
+                  ios.e->name, dir ? "write" : "read", (int)st->nbuf, (int)st->nreq,
+                  st->nbuf ? (int)(st->lat / st->nbuf / 10) : 0, (int)(st->maxlat / 10),
+                  st->depth, st->maxdepth);
+  }
+  return n;
+}
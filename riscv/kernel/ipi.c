@@ -0,0 +1,161 @@
+// Inter-processor interrupts.
+//
+// qemu's virt machine (with aclint=on) provides an ACLINT SSWI
+// device: a store of 1 to a hart's SETSSIP register raises a
+// supervisor software interrupt (sip.SSIP) on that hart.
+// The sender first posts a request bit in the target's
+// cpu->ipi_pending, then rings the doorbell; the target clears
+// SSIP and handles every posted bit in ipi_intr().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+// TLB shootdown request ticket, taken by the sender after it has
+// changed the PTEs. A hart that reads ticket t before its sfence.vma
+// has flushed everything those senders changed, and publishes t as
+// its cpu->tlbdone.
+static uint64 tlbticket;
+
+// Post request bits for hart and interrupt it.
+void
+ipi_send(int hart, int type)
+{
+  __atomic_fetch_or(&cpus[hart].ipi_pending, type, __ATOMIC_SEQ_CST);
+  __sync_synchronize();
+  *(volatile uint32 *)ACLINT_SETSSIP(hart) = 1;
+}
+
+// Handle the requests posted for this hart.
+// Interrupts must be disabled.
+static void
+ipi_handle(struct cpu *c)
+{
+  int pending = __atomic_exchange_n(&c->ipi_pending, 0, __ATOMIC_SEQ_CST);
+
+  if(pending & IPI_TLBFLUSH){
+    uint64 t = __atomic_load_n(&tlbticket, __ATOMIC_SEQ_CST);
+    sfence_vma();
+    __atomic_store_n(&c->tlbdone, t, __ATOMIC_SEQ_CST);
+  }
+  // an idle hart has already been knocked out of wfi and
+  // scheduler() rescans; a busy one gives up its process
+  // on the way out of usertrap()/kerneltrap().
+  if(pending & IPI_RESCHED)
+    c->need_resched = 1;
+}
+
+// Serve requests posted for this hart while it spins with
+// interrupts off, e.g. in acquire(); a hart waiting in
+// tlb_shootdown() would otherwise never get its acknowledgement.
+void
+ipi_poll(void)
+{
+  struct cpu *c = mycpu();
+
+  if(c->ipi_pending)
+    ipi_handle(c);
+}
+
+// Supervisor software interrupt, from devintr().
+void
+ipi_intr(void)
+{
+  w_sip(r_sip() & ~SIP_SSIP);
+  // taking an interrupt means no RCU reader is running here;
+  // that is all an IPI_RCU asks for.
+  rcu_qs();
+  ipi_handle(mycpu());
+}
+
+// Wake an idle hart so that it notices the newly RUNNABLE p.
+// A pinned process can only be picked up by its own hart; anything
+// else goes to the first idle hart we can claim. The claim (idle
+// 1 -> 0) keeps several concurrent wakeups from all kicking the
+// same hart while other harts stay asleep.
+// Returns 1 if some idle hart will pick p up, 0 if all eligible
+// harts are busy.
+int
+ipi_kick(struct proc *p)
+{
+  struct cpu *self, *c;
+  int kicked = 0;
+
+  push_off();
+  self = mycpu();
+  if(self->idle && (p->pincpu == 0 || p->pincpu == self)){
+    // we are the scheduler of an idle hart (e.g. in a device
+    // interrupt taken from wfi), and are about to rescan anyway.
+    pop_off();
+    return 1;
+  }
+// LAB_LOCK
+  if(p->pincpu){
+    c = p->pincpu;
+    if(c != self && __sync_bool_compare_and_swap(&c->idle, 1, 0)){
+      ipi_send(c - cpus, IPI_RESCHED);
+      kicked = 1;
+    }
+    pop_off();
+    return kicked;
+  }
+// END LAB_LOCK
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    if(c != self && __sync_bool_compare_and_swap(&c->idle, 1, 0)){
+      ipi_send(c - cpus, IPI_RESCHED);
+      kicked = 1;
+      break;
+    }
+  }
+  pop_off();
+  return kicked;
+}
+
+// Make sure no other hart keeps stale TLB entries for pagetable.
+// Only harts currently running a process with this page table can
+// hold any: every other switch to a user page table goes through
+// the sfence.vma in userret. Waits until each target has flushed,
+// so the caller may free the unmapped pages afterwards.
+void
+tlb_shootdown(pagetable_t pagetable)
+{
+  struct cpu *self, *c;
+  struct proc *p;
+  char wait[NCPU];
+  uint64 ticket;
+  int n = 0;
+
+  push_off();
+  self = mycpu();
+  // the PTEs have been changed already: any flush that starts
+  // after this has seen the change.
+  ticket = __atomic_add_fetch(&tlbticket, 1, __ATOMIC_SEQ_CST);
+  for(c = cpus; c < &cpus[NCPU]; c++){
+    wait[c - cpus] = 0;
+    if(c == self)
+      continue;
+    p = c->proc;
+    if(p == 0 || p->pagetable != pagetable)
+      continue;
+    wait[c - cpus] = 1;
+    ipi_send(c - cpus, IPI_TLBFLUSH);
+    n++;
+  }
+
+  // wait for the acknowledgements. the targets may be waiting
+  // on us in the same way with interrupts off, so keep serving
+  // our own posted requests while spinning.
+  while(n > 0){
+    n = 0;
+    for(c = cpus; c < &cpus[NCPU]; c++){
+      if(wait[c - cpus] && __atomic_load_n(&c->tlbdone, __ATOMIC_SEQ_CST) < ticket)
+        n++;
+    }
+    ipi_poll();
+  }
+  pop_off();
+}
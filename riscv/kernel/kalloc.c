@@ -119,11 +119,8 @@ kfree(void *pa)
   pop_off();
 }
 
-// Allocate one 4096-byte page of physical memory.
-// Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
-void *
-kalloc(void)
+static void *
+kalloc1(void)
 {
   struct run *r;
 
@@ -195,6 +192,20 @@ kalloc(void)
   return (void*)r;
 }
 
+// Allocate one 4096-byte page of physical memory.
+// Returns a pointer that the kernel can use.
+// Returns 0 if the memory cannot be allocated.
+void *
+kalloc(void)
+{
+  void *pa;
+
+  // 内存用完时先让缓冲区缓存还回几页，再清空 fork 缓存，然后重试
+  if((pa = kalloc1()) == 0 && (bcache_shrink(8) > 0 || forkcache_drain() > 0))
+    pa = kalloc1();
+  return pa;
+}
+
 // 获取页面对应的引用计数
 int
 get_refcnt(void *pa)
@@ -2,6 +2,8 @@
 #include "param.h"
 #include "memlayout.h"
 #include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
 #include "defs.h"
 
 volatile static int started = 0;
@@ -45,7 +47,10 @@ main()
     iinit();         // inode table
     fileinit();      // file table
     shm_init();       // shared memory
+    futexinit();     // futex wait queues
+    rcuinit();       // RCU callbacks
     virtio_disk_init(); // emulated hard disk
+    iosched_init();  // block I/O scheduler
     // LAB_NET
     pci_init();
     netinit();
@@ -63,5 +68,6 @@ main()
     plicinithart();   // ask PLIC for device interrupts
   }
 
+  mycpu()->online = 1;
   scheduler();        
 }
@@ -5,6 +5,7 @@
 //
 // 00001000 -- boot ROM, provided by qemu
 // 02000000 -- CLINT
+// 02F00000 -- ACLINT SSWI (with -machine virt,aclint=on)
 // 0C000000 -- PLIC
 // 10000000 -- uart0 
 // 10001000 -- virtio disk 
@@ -29,6 +30,11 @@
 #define E1000_IRQ 33
 // END LAB_NET
 
+// ACLINT supervisor software interrupt device: one 32-bit
+// SETSSIP register per hart; writing 1 raises sip.SSIP there.
+#define ACLINT_SSWI 0x02F00000L
+#define ACLINT_SETSSIP(hart) (ACLINT_SSWI + 4*(hart))
+
 // qemu puts platform-level interrupt controller (PLIC) here.
 #define PLIC 0x0c000000L
 #define PLIC_PRIORITY (PLIC + 0x0)
@@ -58,6 +64,16 @@
 //   fixed-size stack
 //   expandable heap
 //   ...
+//   ...
+//   THREADFRAME(MAXTHREAD-1) .. THREADFRAME(1) (other threads' trapframes)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+
+// each thread of a process has its own trapframe page in the
+// shared page table; the first thread's is TRAPFRAME.
+#define MAXTHREAD 16
+#define THREADFRAME(k) (TRAPFRAME - (k)*PGSIZE)
+
+// user memory (sbrk, mmap) must stay below all of them.
+#define USERTOP THREADFRAME(MAXTHREAD-1)
@@ -9,6 +9,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "net.h"
+#include "rcu.h"
 
 // xv6's ethernet and IP addresses
 static uint8 local_mac[ETHADDR_LEN] = { 0x52, 0x54, 0x00, 0x12, 0x34, 0x56 };
@@ -17,7 +18,7 @@ static uint32 local_ip = MAKE_IP_ADDR(10, 0, 2, 15);
 // qemu host's ethernet address.
 static uint8 host_mac[ETHADDR_LEN] = { 0x52, 0x55, 0x0a, 0x00, 0x02, 0x02 };
 
-static struct spinlock netlock;
+static struct spinlock netlock;   // 修改端口表时持有
 
 
 // 数据包节点结构体
@@ -35,14 +36,18 @@ struct packetq {
 
 // 端口数据结构，用于跟踪绑定的端口和等待的数据包
 struct sock {
-  struct spinlock lock;  // 保护这个结构体的锁
-  uint16 rport;          // 接收端口
+  struct rcu_head rcu;   // 必须在最前面，sock_free() 据此转换指针
+  struct spinlock lock;  // 保护 q、dead 和 ref
+  uint16 rport;          // 接收端口，发布之后不再改变
   struct packetq q;      // 数据包队列
-  int used;              // 标记端口是否已使用
+  int dead;              // unbind 之后置 1
+  int ref;               // 睡在 recv 里的进程数
 };
 
-// 全局端口表，最多支持 16 个端口
-struct sock socks[16];
+// 全局端口表，最多支持 16 个端口。查找时不加锁（RCU 读者），
+// bind/unbind 持 netlock 修改，unbind 摘下的 sock 过了宽限期才释放。
+#define NSOCK 16
+static struct sock *socks[NSOCK];
 
 // 初始化数据包队列
 void
@@ -112,6 +117,36 @@ netinit(void)
   initlock(&netlock, "netlock");
 }
 
+static void
+sock_free(struct rcu_head *h)
+{
+  kfree((char *)h);
+}
+
+// 查找绑定到 dport 的 sock，找到时返回并持有 s->lock。
+// 遍历端口表不加锁；读临界区保证拿到 s->lock 之前 s 不会被释放，
+// 拿到锁之后 dead 为 0 说明 unbind 还没有处理它。
+static struct sock*
+sock_lookup(uint16 dport)
+{
+  struct sock *s;
+
+  rcu_read_lock();
+  for(int i = 0; i < NSOCK; i++) {
+    s = rcu_dereference(socks[i]);
+    if(s && s->rport == dport) {
+      acquire(&s->lock);
+      if(!s->dead) {
+        rcu_read_unlock();
+        return s;
+      }
+      release(&s->lock);
+    }
+  }
+  rcu_read_unlock();
+  return 0;
+}
+
 
 //
 // bind(int port)
@@ -126,20 +161,27 @@ sys_bind(void)
   // 获取端口号参数
   argint(0, &port);
     
+  struct sock *s = (struct sock *)kalloc();
+  if(s == 0)
+    return -1;
+  memset(s, 0, sizeof(*s));
+  initlock(&s->lock, "sock");
+  s->rport = port;
+  packetq_init(&s->q);
+
   // 查找可用的端口表项
-  for(int i = 0; i < 16; i++) {
-    acquire(&socks[i].lock);
-    if(socks[i].used == 0) {
-      // 标记为已使用并设置端口号
-      socks[i].used = 1;
-      socks[i].rport = port;
-      release(&socks[i].lock);
+  acquire(&netlock);
+  for(int i = 0; i < NSOCK; i++) {
+    if(socks[i] == 0) {
+      rcu_assign_pointer(socks[i], s);
+      release(&netlock);
       return 0;
     }
-    release(&socks[i].lock);
   }
+  release(&netlock);
   
   // 没有可用的端口表项
+  kfree((char *)s);
   return -1;
 }
 
@@ -151,9 +193,37 @@ sys_bind(void)
 uint64
 sys_unbind(void)
 {
-  //
-  // Optional: Your code here.
-  //
+  int port, ref;
+  struct sock *s = 0;
+  struct packet_node *node;
+
+  argint(0, &port);
+
+  acquire(&netlock);
+  for(int i = 0; i < NSOCK; i++) {
+    if(socks[i] && socks[i]->rport == port) {
+      s = socks[i];
+      rcu_assign_pointer(socks[i], 0);
+      break;
+    }
+  }
+  release(&netlock);
+  if(s == 0)
+    return -1;
+
+  // 丢掉排队的数据包，叫醒 recv 里的进程。最后一个离开的
+  // 进程负责释放；没有人在等就在这里释放。
+  acquire(&s->lock);
+  s->dead = 1;
+  while((node = packetq_pop(&s->q)) != 0) {
+    kfree(node->buf);
+    kfree((char *)node);
+  }
+  wakeup(&s->q);
+  ref = s->ref;
+  release(&s->lock);
+  if(ref == 0)
+    call_rcu(&s->rcu, sock_free);
 
   return 0;
 }
@@ -188,23 +258,24 @@ sys_recv(void)
   argint(4, &maxlen);
   
   // 查找绑定的端口
-  struct sock *s = 0;
-  for(int i = 0; i < 16; i++) {
-    acquire(&socks[i].lock);
-    if(socks[i].used && socks[i].rport == dport) {
-      s = &socks[i];
-      break;
-    }
-    release(&socks[i].lock);
-  }
+  struct sock *s = sock_lookup(dport);
   
   if(!s)
     return -1; // 端口未绑定
   
-  // 等待数据包到达
-  while(packetq_empty(&s->q)) {
+  // 等待数据包到达。睡眠期间持有引用，unbind 不会释放 s。
+  s->ref++;
+  while(packetq_empty(&s->q) && !s->dead) {
     sleep(&s->q, &s->lock);
   }
+  s->ref--;
+  if(s->dead) {
+    int last = s->ref == 0;
+    release(&s->lock);
+    if(last)
+      call_rcu(&s->rcu, sock_free);
+    return -1;
+  }
   
   // 取出数据包
   struct packet_node *node = packetq_pop(&s->q);
@@ -383,15 +454,7 @@ ip_rx(char *buf, int len)
   uint16 dport = ntohs(udp->dport);
   
   // 查找绑定的端口
-  struct sock *s = 0;
-  for(int i = 0; i < 16; i++) {
-    acquire(&socks[i].lock);
-    if(socks[i].used && socks[i].rport == dport) {
-      s = &socks[i];
-      break;
-    }
-    release(&socks[i].lock);
-  }
+  struct sock *s = sock_lookup(dport);
   
   if(!s) {
     // 端口未绑定，丢弃数据包
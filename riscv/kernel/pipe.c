@@ -68,9 +68,6 @@ pipeclose(struct pipe *pi, int writable)
   }
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-// LAB_LOCK
-    freelock(&pi->lock);
-//
     kfree((char*)pi);
   } else
     release(&pi->lock);
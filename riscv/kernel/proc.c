@@ -5,60 +5,243 @@
 #include "spinlock.h"
 #include "proc.h"
 #include "defs.h"
+#include "times.h"
+#include "wait.h"
 #include "fcntl.h"
 #include "syscall.h"  // 添加共享内存系统调用声明
 
 struct cpu cpus[NCPU];
 
-struct proc proc[NPROC];
-
 struct proc *initproc;
 
+// 进程表：struct proc 从 slab 分配，没有 NPROC 上限。
+// pid_lock 保护 nextpid、pid 哈希表、活动进程链表和 nproc。
+// 活动进程链表新进程插在表头，摘除时保留 allnext，因此调度器
+// 可以不加锁遍历（见 pick_next()）。
+#define NPIDHASH 64
+#define PROCPAGES 64      // 每个进程按 64 页内存估算 maxproc
+
 int nextpid = 1;
 struct spinlock pid_lock;
+static struct proc *pidhash[NPIDHASH];
+static struct proc *allproc;
+static int nproc;         // 活动进程数
+static int maxproc;       // 由启动时的空闲内存决定，类似 Linux 的 threads-max
+
+// slab：整页切成 struct proc，释放的对象只回到 procfree。
+// 每个对象第一次使用时分配并映射内核栈，之后一直保留。
+static struct spinlock procslab_lock;
+static struct proc *procfree;
+static int nkstack;                // 已映射的内核栈槽位数
+static volatile uint64 kstackgen;  // 每映射一个新内核栈加 1
+extern pagetable_t kernel_pagetable;
+
+// Walk the live processes without pid_lock. May visit a process
+// that is being freed, or miss one created during the walk.
+#define for_each_proc(p) \
+  for(p = __atomic_load_n(&allproc, __ATOMIC_ACQUIRE); p; \
+      p = __atomic_load_n(&p->allnext, __ATOMIC_ACQUIRE))
 
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static void wake_kick(struct proc *p);
+static void place_wakeup(struct proc *p);
+void reparent(struct proc *p);
 
 extern char trampoline[]; // trampoline.S
 
-// helps ensure that wakeups of wait()ing
-// parents are not lost. helps obey the
-// memory model when using p->parent.
-// must be acquired before any p->lock.
-struct spinlock wait_lock;
+// 公平调度：每个进程按 nice 值得到一个权重，运行时间按
+// NICE_0_WEIGHT/weight 折算为 vruntime，调度器总是挑选
+// vruntime 最小的 RUNNABLE 进程。权重表取自 Linux CFS，
+// 相邻两级相差约 1.25 倍，即 nice 每差 1 级 CPU 份额差约 10%。
+#define NICE_0_WEIGHT 1024
+static const int nice_to_weight[40] = {
+ /* -20 */ 88761, 71755, 56483, 46273, 36291,
+ /* -15 */ 29154, 23254, 18705, 14949, 11916,
+ /* -10 */  9548,  7620,  6100,  4904,  3906,
+ /*  -5 */  3121,  2501,  1991,  1586,  1277,
+ /*   0 */  1024,   820,   655,   526,   423,
+ /*   5 */   335,   272,   215,   172,   137,
+ /*  10 */   110,    87,    70,    56,    45,
+ /*  15 */    36,    29,    23,    18,    15,
+};
+
+// 睡眠醒来的进程最多比 min_vruntime 落后这么多（约两个时钟
+// 滴答），避免长时间睡眠后独占 CPU。
+#define SCHED_LATENCY 2000000
+
+// 所有 hart 上最近被选中进程的 vruntime，单调不减。
+static uint64 min_vruntime;
+
+// 实时进程变为 RUNNABLE 的全局序号，同优先级按它先来先服务。
+static uint64 rtseq_next;
+
+// 每个进程的 childlock 保护它的 children/zombies 链表，以及
+// 其中子进程的 parent/sibling 字段；它保证 wait() 中的父进程
+// 不会丢失唤醒。必须在任何 p->lock 之前获取。两把 childlock
+// 同时持有时（reparent），initproc 的在后。
+
+// 每个 CPU 缓存一些用完的 trapframe 页和页表骨架（只映射了
+// TRAMPOLINE 的根页表及通往它的两级页表），fork/exec 时直接取用，
+// 省去分配、清零和建立映射。平时只访问本 CPU 的缓存，
+// 内存用完时 forkcache_drain() 会清空所有 CPU 的，所以也要加锁。
+#define NFORKCACHE 8
+
+static struct forkcache {
+  struct spinlock lock;
+  int ntf, npt;
+  void *tf[NFORKCACHE];
+  pagetable_t pt[NFORKCACHE];
+} forkcache[NCPU];
+
+// 线程组共享的地址空间和打开文件表，放在首线程的 struct proc
+// 里（mm0、files0）。tg_lock 保护两者的 ref。
+static struct spinlock tg_lock;
 
-// Allocate a page for each process's kernel stack.
-// Map it high in memory, followed by an invalid
-// guard page.
+// initialize the proc table.
 void
-proc_mapstacks(pagetable_t kpgtbl)
+procinit(void)
 {
-  struct proc *p;
-  
-  for(p = proc; p < &proc[NPROC]; p++) {
-    char *pa = kalloc();
-    if(pa == 0)
-      panic("kalloc");
-    // kalloc已经初始化了引用计数，这里不需要额外处理
-    uint64 va = KSTACK((int) (p - proc));
-    kvmmap(kpgtbl, va, (uint64)pa, PGSIZE, PTE_R | PTE_W);
+  uint64 n;
+
+  if(sizeof(struct proc) > PGSIZE)
+    panic("procinit: struct proc");
+  initlock(&pid_lock, "nextpid");
+  initlock(&procslab_lock, "procslab");
+  initlock(&tg_lock, "tg_lock");
+  for(int i = 0; i < NCPU; i++)
+    initlock(&forkcache[i].lock, "forkcache");
+  freebytes(&n);
+  maxproc = n / PGSIZE / PROCPAGES;
+  if(maxproc < 8)
+    maxproc = 8;
+}
+
+// Allocate a page for p's kernel stack and map it high in the
+// kernel page table, followed by an invalid guard page. The
+// stack stays with p for good. Other harts may have cached the
+// invalid PTE, so scheduler() does an sfence.vma before running
+// a process whenever kstackgen has moved.
+static int
+proc_mapkstack(struct proc *p)
+{
+  char *pa;
+  uint64 va;
+
+  if((pa = kalloc()) == 0)
+    return -1;
+  acquire(&procslab_lock);
+  va = KSTACK(nkstack);
+  if(va < PHYSTOP || mappages(kernel_pagetable, va, PGSIZE, (uint64)pa, PTE_R | PTE_W) != 0){
+    release(&procslab_lock);
+    kfree(pa);
+    return -1;
   }
+  nkstack++;
+  __atomic_fetch_add(&kstackgen, 1, __ATOMIC_RELEASE);
+  release(&procslab_lock);
+  sfence_vma();
+  p->kstack = va;
+  return 0;
 }
 
-// initialize the proc table.
-void
-procinit(void)
+// Take a struct proc from the slab, growing it by a page if
+// needed. The result is UNUSED and not yet visible to anyone.
+static struct proc*
+procslab_alloc(void)
 {
   struct proc *p;
-  
-  initlock(&pid_lock, "nextpid");
-  initlock(&wait_lock, "wait_lock");
-  for(p = proc; p < &proc[NPROC]; p++) {
+  char *page;
+
+  acquire(&procslab_lock);
+  if(procfree == 0){
+    if((page = kalloc()) == 0){
+      release(&procslab_lock);
+      return 0;
+    }
+    memset(page, 0, PGSIZE);
+    for(p = (struct proc *)page; (char *)(p + 1) <= page + PGSIZE; p++){
       initlock(&p->lock, "proc");
+      initlock(&p->childlock, "childlock");
+      initlock(&p->mm0.lock, "mm");
+      initlock(&p->files0.lock, "files");
       p->state = UNUSED;
-      p->kstack = KSTACK((int) (p - proc));
+      p->freenext = procfree;
+      procfree = p;
+    }
+  }
+  p = procfree;
+  procfree = p->freenext;
+  release(&procslab_lock);
+
+  if(p->kstack == 0 && proc_mapkstack(p) < 0){
+    acquire(&procslab_lock);
+    p->freenext = procfree;
+    procfree = p;
+    release(&procslab_lock);
+    return 0;
+  }
+  return p;
+}
+
+// Get a trapframe page, from this CPU's cache if possible.
+static struct trapframe*
+tf_alloc(void)
+{
+  struct forkcache *fc;
+  void *tf = 0;
+
+  push_off();
+  fc = &forkcache[cpuid()];
+  acquire(&fc->lock);
+  if(fc->ntf > 0)
+    tf = fc->tf[--fc->ntf];
+  release(&fc->lock);
+  pop_off();
+  if(tf == 0)
+    tf = kalloc();
+  return tf;
+}
+
+static void
+tf_free(struct trapframe *tf)
+{
+  struct forkcache *fc;
+
+  push_off();
+  fc = &forkcache[cpuid()];
+  acquire(&fc->lock);
+  if(fc->ntf < NFORKCACHE){
+    fc->tf[fc->ntf++] = tf;
+    tf = 0;
+  }
+  release(&fc->lock);
+  pop_off();
+  if(tf)
+    kfree(tf);
+}
+
+// Find the live process with the given pid.
+// Returns with p->lock held, or 0.
+static struct proc*
+pid_lookup(int pid)
+{
+  struct proc *p;
+
+  acquire(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  release(&pid_lock);
+  if(p == 0)
+    return 0;
+  // p may have been freed meanwhile; pids are never reused.
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
   }
+  return p;
 }
 
 // Must be called with interrupts disabled,
@@ -92,44 +275,186 @@ myproc(void)
   return p;
 }
 
-int
-allocpid()
+// Give p a pid and make it visible in the pid hash and the
+// live process list. Fails if there are maxproc processes.
+static int
+proc_publish(struct proc *p)
 {
-  int pid;
-  
+  struct proc **h;
+
+  acquire(&pid_lock);
+  if(nproc >= maxproc){
+    release(&pid_lock);
+    return -1;
+  }
+  nproc++;
+  p->pid = nextpid++;
+  h = &pidhash[p->pid % NPIDHASH];
+  p->pidnext = *h;
+  *h = p;
+  p->allnext = allproc;
+  if(allproc)
+    allproc->allpprev = &p->allnext;
+  p->allpprev = &allproc;
+  __atomic_store_n(&allproc, p, __ATOMIC_RELEASE);
+  release(&pid_lock);
+  return 0;
+}
+
+// Undo proc_publish(). p->allnext is left alone so that a
+// lockless walker standing on p can still move on.
+static void
+proc_unpublish(struct proc *p)
+{
+  struct proc **pp;
+
   acquire(&pid_lock);
-  pid = nextpid;
-  nextpid = nextpid + 1;
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  *p->allpprev = p->allnext;
+  if(p->allnext)
+    p->allnext->allpprev = p->allpprev;
+  nproc--;
   release(&pid_lock);
+}
 
-  return pid;
+static struct mm*
+mm_alloc(struct proc *p)
+{
+  struct mm *mm = &p->mm0;
+
+  acquire(&tg_lock);
+  if(mm->ref != 0)
+    panic("mm_alloc");
+  mm->ref = 1;
+  mm->slots = 1;    // slot 0, TRAPFRAME, belongs to the first thread
+  mm->sz = 0;
+  release(&tg_lock);
+  return mm;
 }
 
-// Look in the process table for an UNUSED proc.
+static void
+mm_put(struct mm *mm)
+{
+  acquire(&tg_lock);
+  mm->ref--;
+  release(&tg_lock);
+}
+
+static struct files*
+files_alloc(struct proc *p)
+{
+  struct files *fs = &p->files0;
+
+  acquire(&tg_lock);
+  if(fs->ref != 0)
+    panic("files_alloc");
+  fs->ref = 1;
+  release(&tg_lock);
+  memset(fs->ofile, 0, sizeof(fs->ofile));
+  return fs;
+}
+
+// Drop a reference to an open file table; the last one closes
+// all of its files, which may sleep.
+static void
+files_put(struct files *fs)
+{
+  int last;
+
+  acquire(&tg_lock);
+  last = (fs->ref == 1);
+  if(!last)
+    fs->ref--;
+  release(&tg_lock);
+  if(!last)
+    return;
+
+  for(int fd = 0; fd < NOFILE; fd++){
+    if(fs->ofile[fd]){
+      struct file *f = fs->ofile[fd];
+      fs->ofile[fd] = 0;
+      fileclose(f);
+    }
+  }
+  acquire(&tg_lock);
+  fs->ref = 0;
+  release(&tg_lock);
+}
+
+// Push c onto a children or zombies list.
+// Caller holds the list owner's childlock.
+static void
+child_link(struct proc **head, struct proc *c)
+{
+  c->sibling = *head;
+  if(*head)
+    (*head)->psibling = &c->sibling;
+  *head = c;
+  c->psibling = head;
+}
+
+// Take c off whichever list it is on.
+// Caller holds c->parent->childlock.
+static void
+child_unlink(struct proc *c)
+{
+  *c->psibling = c->sibling;
+  if(c->sibling)
+    c->sibling->psibling = c->psibling;
+  c->sibling = 0;
+  c->psibling = 0;
+}
+
+// Lock p's parent's childlock and return the parent. The parent
+// can change under us (reparent() to init) until we hold its
+// lock, so check again afterwards.
+static struct proc*
+lock_parent(struct proc *p)
+{
+  struct proc *pp;
+
+  for(;;){
+    pp = __atomic_load_n(&p->parent, __ATOMIC_ACQUIRE);
+    if(pp == 0)
+      return 0;
+    acquire(&pp->childlock);
+    if(p->parent == pp)
+      return pp;
+    release(&pp->childlock);
+  }
+}
+
+// Allocate a proc from the slab.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
-// If there are no free procs, or a memory allocation fails, return 0.
+// If there are too many procs, or a memory allocation fails, return 0.
 static struct proc*
 allocproc(void)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
-    acquire(&p->lock);
-    if(p->state == UNUSED) {
-      goto found;
-    } else {
-      release(&p->lock);
-    }
-  }
-  return 0;
+  if((p = procslab_alloc()) == 0)
+    return 0;
 
-found:
-  p->pid = allocpid();
+  acquire(&p->lock);
   p->state = USED;
+  if(proc_publish(p) < 0){
+    p->state = UNUSED;
+    release(&p->lock);
+    acquire(&procslab_lock);
+    p->freenext = procfree;
+    procfree = p;
+    release(&procslab_lock);
+    return 0;
+  }
 
   // Allocate a trapframe page.
-  if((p->trapframe = (struct trapframe *)kalloc()) == 0){
+  if((p->trapframe = tf_alloc()) == 0){
     freeproc(p);
     release(&p->lock);
     return 0;
@@ -139,7 +464,15 @@ found:
   p->pincpu = 0;
 // END LAB_LOCK
 
+  p->policy = SCHED_OTHER;
+  p->rtprio = 0;
+  p->nice = 0;
+  p->vruntime = __atomic_load_n(&min_vruntime, __ATOMIC_RELAXED);
+  p->utime = p->stime = 0;
+  p->cutime = p->cstime = 0;
+
   // An empty user page table.
+  p->tfva = TRAPFRAME;
   p->pagetable = proc_pagetable(p);
   if(p->pagetable == 0){
     freeproc(p);
@@ -147,6 +480,12 @@ found:
     return 0;
   }
 
+  // its own address space and open file table, until clone()
+  // makes it share the caller's.
+  p->mm = mm_alloc(p);
+  p->files = files_alloc(p);
+  p->ofile = p->files->ofile;
+
   // Set up new context to start executing at forkret,
   // which returns to user space.
   memset(&p->context, 0, sizeof(p->context));
@@ -166,19 +505,37 @@ static void
 freeproc(struct proc *p)
 {
   if(p->trapframe)
-    kfree((void*)p->trapframe);
+    tf_free(p->trapframe);
   p->trapframe = 0;
-  if(p->pagetable)
-    proc_freepagetable(p->pagetable, p->sz);
+  // a thread's page table belongs to the whole process; the
+  // process's first thread frees it, after all others are gone.
+  if(p->pagetable && !p->thread)
+    proc_freepagetable(p->pagetable, p->mm->sz);
   p->pagetable = 0;
-  p->sz = 0;
-  p->pid = 0;
+  if(p->mm)
+    mm_put(p->mm);
+  p->mm = 0;
+  if(p->files)
+    files_put(p->files);   // only on allocproc()/kclone() failure: empty
+  p->files = 0;
+  p->ofile = 0;
+  p->thread = 0;
+  p->kfn = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  proc_unpublish(p);
+  p->pid = 0;
   p->state = UNUSED;
+
+  // back to the slab. the caller still holds p->lock; a new
+  // owner will wait for it in allocproc().
+  acquire(&procslab_lock);
+  p->freenext = procfree;
+  procfree = p;
+  release(&procslab_lock);
 }
 
 // Create a user page table for a given process, with no user memory,
@@ -186,21 +543,34 @@ freeproc(struct proc *p)
 pagetable_t
 proc_pagetable(struct proc *p)
 {
-  pagetable_t pagetable;
+  pagetable_t pagetable = 0;
+  struct forkcache *fc;
 
-  // An empty page table.
-  pagetable = uvmcreate();
-  if(pagetable == 0)
-    return 0;
+  // a skeleton left over from an exited process already has
+  // the trampoline and the page-table pages above it.
+  push_off();
+  fc = &forkcache[cpuid()];
+  acquire(&fc->lock);
+  if(fc->npt > 0)
+    pagetable = fc->pt[--fc->npt];
+  release(&fc->lock);
+  pop_off();
 
-  // map the trampoline code (for system call return)
-  // at the highest user virtual address.
-  // only the supervisor uses it, on the way
-  // to/from user space, so not PTE_U.
-  if(mappages(pagetable, TRAMPOLINE, PGSIZE,
-              (uint64)trampoline, PTE_R | PTE_X) < 0){
-    uvmfree(pagetable, 0);
-    return 0;
+  if(pagetable == 0){
+    // An empty page table.
+    pagetable = uvmcreate();
+    if(pagetable == 0)
+      return 0;
+
+    // map the trampoline code (for system call return)
+    // at the highest user virtual address.
+    // only the supervisor uses it, on the way
+    // to/from user space, so not PTE_U.
+    if(mappages(pagetable, TRAMPOLINE, PGSIZE,
+                (uint64)trampoline, PTE_R | PTE_X) < 0){
+      uvmfree(pagetable, 0);
+      return 0;
+    }
   }
 
   // map the trapframe page just below the trampoline page, for
@@ -216,13 +586,64 @@ proc_pagetable(struct proc *p)
 }
 
 // Free a process's page table, and free the
-// physical memory it refers to.
+// physical memory it refers to. The skeleton
+// goes to this CPU's cache if there is room.
 void
 proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
-  uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+  struct forkcache *fc;
+
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
-  uvmfree(pagetable, sz);
+  if(sz > 0)
+    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
+  uvmstrip(pagetable);
+
+  push_off();
+  fc = &forkcache[cpuid()];
+  acquire(&fc->lock);
+  if(fc->npt < NFORKCACHE){
+    fc->pt[fc->npt++] = pagetable;
+    pagetable = 0;
+  }
+  release(&fc->lock);
+  pop_off();
+
+  if(pagetable){
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    freewalk(pagetable);
+  }
+}
+
+// Give every CPU's cached trapframes and page-table skeletons
+// back to kalloc(). Called when memory runs out.
+// Returns the number of pages freed.
+int
+forkcache_drain(void)
+{
+  struct forkcache *fc;
+  void *tf[NFORKCACHE];
+  pagetable_t pt[NFORKCACHE];
+  int ntf, npt, freed = 0;
+
+  for(fc = forkcache; fc < &forkcache[NCPU]; fc++){
+    acquire(&fc->lock);
+    ntf = fc->ntf;
+    npt = fc->npt;
+    memmove(tf, fc->tf, ntf * sizeof(tf[0]));
+    memmove(pt, fc->pt, npt * sizeof(pt[0]));
+    fc->ntf = fc->npt = 0;
+    release(&fc->lock);
+
+    for(int i = 0; i < ntf; i++)
+      kfree(tf[i]);
+    for(int i = 0; i < npt; i++){
+      uvmunmap(pt[i], TRAMPOLINE, 1, 0);
+      freewalk(pt[i]);
+    }
+    // a skeleton is the root and two levels below it.
+    freed += ntf + 3 * npt;
+  }
+  return freed;
 }
 
 // Set up first user process.
@@ -241,6 +662,41 @@ userinit(void)
   release(&p->lock);
 }
 
+// A kernel thread's first scheduling switches to kthread_start.
+static void
+kthread_start(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler.
+  release(&p->lock);
+
+  p->kfn();
+  panic("kthread returned");
+}
+
+// Start a kernel thread running fn(), which must not return.
+// It has no parent, never goes to user space and cannot be
+// killed. Returns its pid, or -1.
+int
+kthread_create(char *name, void (*fn)(void))
+{
+  struct proc *p;
+  int pid;
+
+  if((p = allocproc()) == 0)
+    return -1;
+  p->kfn = fn;
+  p->context.ra = (uint64)kthread_start;
+  safestrcpy(p->name, name, sizeof(p->name));
+  p->state = RUNNABLE;
+  p->rtseq = __atomic_fetch_add(&rtseq_next, 1, __ATOMIC_RELAXED);
+  pid = p->pid;
+  release(&p->lock);
+  wake_kick(p);
+  return pid;
+}
+
 // Grow or shrink user memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -249,21 +705,44 @@ growproc(int n)
   uint64 sz;
   struct proc *p = myproc();
 
-  sz = p->sz;
+  acquire(&p->mm->lock);
+  sz = p->mm->sz;
   if(n > 0){
-    if(sz + n > TRAPFRAME) {
+    if(sz + n > USERTOP) {
+      release(&p->mm->lock);
       return -1;
     }
     if((sz = uvmalloc(p->pagetable, sz, sz + n, PTE_W)) == 0) {
+      release(&p->mm->lock);
       return -1;
     }
   } else if(n < 0){
     sz = uvmdealloc(p->pagetable, sz, sz + n);
   }
-  p->sz = sz;
+  p->mm->sz = sz;
+  release(&p->mm->lock);
   return 0;
 }
 
+// Grow user memory by n bytes without allocating it; vmfault()
+// allocates pages on first touch. Returns the old size, or -1.
+uint64
+growproc_lazy(int n)
+{
+  uint64 addr;
+  struct proc *p = myproc();
+
+  acquire(&p->mm->lock);
+  addr = p->mm->sz;
+  if(addr + n < addr || addr + n > USERTOP){
+    release(&p->mm->lock);
+    return -1;
+  }
+  p->mm->sz = addr + n;
+  release(&p->mm->lock);
+  return addr;
+}
+
 // Create a new process, copying the parent.
 // Sets up child kernel stack to return as if from fork() system call.
 int
@@ -279,12 +758,15 @@ kfork(void)
   }
 
   // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  acquire(&p->mm->lock);
+  if(uvmcopy(p->pagetable, np->pagetable, p->mm->sz) < 0){
+    release(&p->mm->lock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
+  np->mm->sz = p->mm->sz;
+  release(&p->mm->lock);
 
   // copy saved user registers.
   *(np->trapframe) = *(p->trapframe);
@@ -312,34 +794,296 @@ kfork(void)
 
   np->trace_mask = p->trace_mask;         // 子进程继承父进程的syscall_trace
 
+  // 子进程继承调度策略和 nice；vruntime 不低于父进程，
+  // 防止反复 fork 插队。
+  np->policy = p->policy;
+  np->rtprio = p->rtprio;
+  np->nice = p->nice;
+  if(np->vruntime < p->vruntime)
+    np->vruntime = p->vruntime;
+
   pid = np->pid;
 
   release(&np->lock);
 
-  acquire(&wait_lock);
+  acquire(&p->childlock);
   np->parent = p;
-  release(&wait_lock);
+  child_link(&p->children, np);
+  release(&p->childlock);
 
   acquire(&np->lock);
   np->state = RUNNABLE;
+  np->rtseq = __atomic_fetch_add(&rtseq_next, 1, __ATOMIC_RELAXED);
   release(&np->lock);
+  wake_kick(np);
 
   return pid;
 }
 
-// Pass p's abandoned children to init.
-// Caller must hold wait_lock.
+// Create a thread of the current process: it shares the page
+// table, open files and current directory, and starts at fn(arg)
+// on the user stack whose top is stack.
+// Returns the new thread's id (a pid), or -1.
+int
+kclone(uint64 fn, uint64 arg, uint64 stack)
+{
+  int slot, tid;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct mm *mm = p->mm;
+
+  if((np = allocproc()) == 0){
+    return -1;
+  }
+
+  // drop the address space and file table allocproc() made.
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = 0;
+  mm_put(np->mm);
+  np->mm = 0;
+  files_put(np->files);
+  np->files = 0;
+  np->ofile = 0;
+
+  // map np's trapframe in a free slot of the shared page table.
+  acquire(&mm->lock);
+  for(slot = 1; slot < MAXTHREAD; slot++)
+    if((mm->slots & (1L << slot)) == 0)
+      break;
+  if(slot == MAXTHREAD ||
+     mappages(p->pagetable, THREADFRAME(slot), PGSIZE,
+              (uint64)np->trapframe, PTE_R | PTE_W) < 0){
+    release(&mm->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  mm->slots |= (1L << slot);
+  acquire(&tg_lock);
+  mm->ref++;
+  p->files->ref++;
+  release(&tg_lock);
+  np->thread = 1;
+  np->tfva = THREADFRAME(slot);
+  np->pagetable = p->pagetable;
+  np->mm = mm;
+  np->files = p->files;
+  np->ofile = p->files->ofile;
+  release(&mm->lock);
+
+  // start at fn(arg) on the given stack, otherwise with the
+  // caller's registers.
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+
+  np->cwd = idup(p->cwd);
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  np->trace_mask = p->trace_mask;
+  np->policy = p->policy;
+  np->rtprio = p->rtprio;
+  np->nice = p->nice;
+  if(np->vruntime < p->vruntime)
+    np->vruntime = p->vruntime;
+
+  // threads have no parent: wait() ignores them, join() reaps them.
+  tid = np->pid;
+  np->state = RUNNABLE;
+  np->rtseq = __atomic_fetch_add(&rtseq_next, 1, __ATOMIC_RELAXED);
+  release(&np->lock);
+  wake_kick(np);
+
+  return tid;
+}
+
+// The first thread of a process is exiting: kill the other
+// threads and reap them, so that the page table can be freed
+// once this process has been waited for.
+static void
+kill_threads(struct proc *p)
+{
+  struct proc *q;
+  int alive;
+
+  acquire(&p->mm->lock);
+  for(;;){
+    alive = 0;
+    for_each_proc(q){
+      if(q == p || q->mm != p->mm)
+        continue;
+      acquire(&q->lock);
+      if(q->mm == p->mm && q->thread){
+        if(q->state == ZOMBIE){
+          freeproc(q);
+        } else {
+          q->killed = 1;
+          alive = 1;
+          if(q->state == SLEEPING){
+            // as kkill() does.
+            q->state = RUNNABLE;
+            place_wakeup(q);
+            release(&q->lock);
+            wake_kick(q);
+            continue;
+          }
+        }
+      }
+      release(&q->lock);
+    }
+    if(!alive)
+      break;
+    sleep(p->mm, &p->mm->lock);
+  }
+  release(&p->mm->lock);
+}
+
+// Exit path of a thread created by clone(). Its trapframe slot
+// is released now; the proc stays a zombie until join() or the
+// first thread's exit reaps it.
+static void
+kexit_thread(struct proc *p, int status)
+{
+  struct mm *mm = p->mm;
+
+  files_put(p->files);
+  p->files = 0;
+  p->ofile = 0;
+
+  begin_op();
+  iput(p->cwd);
+  end_op();
+  p->cwd = 0;
+
+  // Give any children to init.
+  reparent(p);
+
+  // unmap before taking mm->lock: the shootdown waits on the
+  // other threads, which may be spinning for mm->lock. the slot
+  // stays ours until its bit is cleared below.
+  uvmunmap(p->pagetable, p->tfva, 1, 0);
+  acquire(&mm->lock);
+  mm->slots &= ~(1L << ((TRAPFRAME - p->tfva) / PGSIZE));
+
+  // join() and the exiting first thread sleep on the mm.
+  wakeup(mm);
+
+  acquire(&p->lock);
+
+  p->xstate = status;
+  p->state = ZOMBIE;
+
+  release(&mm->lock);
+
+  // Jump into the scheduler, never to return.
+  sched();
+  panic("zombie exit");
+}
+
+// Wait for thread tid of the current process to exit, and reap it.
+// Returns tid, or -1 if there is no such thread.
+int
+kjoin(int tid, uint64 addr)
+{
+  struct proc *q;
+  struct proc *p = myproc();
+  int xstate, copied = 0;
+
+  acquire(&p->mm->lock);
+  for(;;){
+    q = pid_lookup(tid);
+    if(q && (q == p || q->mm != p->mm || !q->thread)){
+      release(&q->lock);
+      q = 0;
+    }
+    if(q && q->state == ZOMBIE){
+      if(addr != 0 && !copied){
+        // copyout() may fault the page in, which takes mm->lock:
+        // copy without locks, then look the zombie up again.
+        xstate = q->xstate;
+        release(&q->lock);
+        release(&p->mm->lock);
+        if(copyout(p->pagetable, addr, (char *)&xstate, sizeof(xstate)) < 0)
+          return -1;
+        copied = 1;
+        acquire(&p->mm->lock);
+        continue;
+      }
+      freeproc(q);
+      release(&q->lock);
+      release(&p->mm->lock);
+      return tid;
+    }
+    if(q)
+      release(&q->lock);
+    if(q == 0 || killed(p)){
+      release(&p->mm->lock);
+      return -1;
+    }
+    sleep(p->mm, &p->mm->lock);
+  }
+}
+
+// Make ip the current directory of every thread of the current
+// process; takes over the caller's reference to ip.
+// Caller is inside a file system transaction (iput).
+void
+setcwd(struct inode *ip)
+{
+  struct proc *q;
+  struct inode *old[MAXTHREAD];
+  int n = 0;
+  struct proc *p = myproc();
+
+  if(p->mm->ref > 1){
+    for_each_proc(q){
+      if(n == MAXTHREAD - 1)
+        break;
+      if(q == p || q->mm != p->mm)
+        continue;
+      acquire(&q->lock);
+      if(q->mm == p->mm && q->cwd){
+        old[n++] = q->cwd;
+        q->cwd = idup(ip);
+      }
+      release(&q->lock);
+    }
+  }
+  old[n++] = p->cwd;
+  p->cwd = ip;
+  for(int i = 0; i < n; i++)
+    iput(old[i]);
+}
+
+// Pass p's abandoned children, live and zombie, to init.
+// p is exiting, so no new children can appear afterwards.
 void
 reparent(struct proc *p)
 {
   struct proc *pp;
+  int zombies = 0;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  acquire(&p->childlock);
+  if(p->children == 0 && p->zombies == 0){
+    release(&p->childlock);
+    return;
+  }
+  acquire(&initproc->childlock);
+  while((pp = p->children) != 0){
+    child_unlink(pp);
+    pp->parent = initproc;
+    child_link(&initproc->children, pp);
+  }
+  while((pp = p->zombies) != 0){
+    child_unlink(pp);
+    pp->parent = initproc;
+    child_link(&initproc->zombies, pp);
+    zombies = 1;
   }
+  if(zombies)
+    wakeup(initproc);
+  release(&initproc->childlock);
+  release(&p->childlock);
 }
 
 // Exit the current process.  Does not return.
@@ -349,18 +1093,22 @@ void
 kexit(int status)
 {
   struct proc *p = myproc();
+  struct proc *pp;
 
   if(p == initproc)
     panic("init exiting");
 
+  if(p->thread)
+    kexit_thread(p, status);
+
+  // the whole process ends with its first thread.
+  if(p->mm->ref > 1)
+    kill_threads(p);
+
   // Close all open files.
-  for(int fd = 0; fd < NOFILE; fd++){
-    if(p->ofile[fd]){
-      struct file *f = p->ofile[fd];
-      fileclose(f);
-      p->ofile[fd] = 0;
-    }
-  }
+  files_put(p->files);
+  p->files = 0;
+  p->ofile = 0;
 
   // 将进程的已映射区域取消映射
   for (int i = 0; i < NVMA; ++i)
@@ -390,20 +1138,22 @@ kexit(int status)
   end_op();
   p->cwd = 0;
 
-  acquire(&wait_lock);
-
   // Give any children to init.
   reparent(p);
 
-  // Parent might be sleeping in wait().
-  wakeup(p->parent);
-  
+  // Move to the parent's zombie list; the parent
+  // might be sleeping in wait().
+  pp = lock_parent(p);
+  child_unlink(p);
+  child_link(&pp->zombies, p);
+  wakeup(pp);
+
   acquire(&p->lock);
 
   p->xstate = status;
   p->state = ZOMBIE;
 
-  release(&wait_lock);
+  release(&pp->childlock);
 
   // Jump into the scheduler, never to return.
   sched();
@@ -411,52 +1161,220 @@ kexit(int status)
 }
 
 // Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
+// pid > 0 waits for that child only, otherwise for any child.
+// With WNOHANG, return 0 instead of sleeping if no child has
+// exited yet.
+// Return -1 if this process has no (such) children.
 int
-kwait(uint64 addr)
+kwait(int pid, uint64 addr, int options)
 {
   struct proc *pp;
-  int havekids, pid;
+  int havekids;
   struct proc *p = myproc();
 
-  acquire(&wait_lock);
+  acquire(&p->childlock);
 
   for(;;){
-    // Scan through table looking for exited children.
-    havekids = 0;
-    for(pp = proc; pp < &proc[NPROC]; pp++){
-      if(pp->parent == p){
-        // make sure the child isn't still in exit() or swtch().
+    if(pid > 0){
+      // look the child up by pid; the lock also makes sure it
+      // isn't still in exit() or swtch().
+      pp = pid_lookup(pid);
+      if(pp && pp->parent != p){
+        release(&pp->lock);
+        pp = 0;
+      }
+      havekids = (pp != 0);
+      if(pp && pp->state != ZOMBIE){
+        release(&pp->lock);
+        pp = 0;
+      }
+    } else {
+      // any exited child.
+      havekids = (p->children != 0 || p->zombies != 0);
+      if((pp = p->zombies) != 0)
         acquire(&pp->lock);
+    }
 
-        havekids = 1;
-        if(pp->state == ZOMBIE){
-          // Found one.
-          pid = pp->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
-                                  sizeof(pp->xstate)) < 0) {
-            release(&pp->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(pp);
-          release(&pp->lock);
-          release(&wait_lock);
-          return pid;
-        }
+    if(pp){
+      pid = pp->pid;
+      if(addr != 0 && copyout(p->pagetable, addr, (char *)&pp->xstate,
+                              sizeof(pp->xstate)) < 0) {
         release(&pp->lock);
+        release(&p->childlock);
+        return -1;
       }
+      // only once the child is really reaped, or a retried
+      // wait() would count its times again.
+      p->cutime += pp->utime + pp->cutime;
+      p->cstime += pp->stime + pp->cstime;
+      child_unlink(pp);
+      freeproc(pp);
+      release(&pp->lock);
+      release(&p->childlock);
+      return pid;
     }
 
-    // No point waiting if we don't have any children.
+    // No point waiting if we don't have any (such) children.
     if(!havekids || killed(p)){
-      release(&wait_lock);
+      release(&p->childlock);
       return -1;
     }
-    
+    if(options & WNOHANG){
+      release(&p->childlock);
+      return 0;
+    }
+
     // Wait for a child to exit.
-    sleep(p, &wait_lock);  //DOC: wait-sleep
+    sleep(p, &p->childlock);  //DOC: wait-sleep
+  }
+}
+
+// Add the time p just spent on this hart to its vruntime,
+// scaled by its weight. Caller holds p->lock.
+static void
+charge_vruntime(struct proc *p)
+{
+  uint64 delta = r_time() - p->exec_start;
+
+  if(p->policy != SCHED_OTHER)
+    return;
+  p->vruntime += delta * NICE_0_WEIGHT / nice_to_weight[p->nice - NICE_MIN];
+}
+
+// A process that slept for a long time must not come back with a
+// vruntime so far behind that it monopolizes the CPU. A real-time
+// process instead goes to the back of its priority's FIFO queue.
+// Caller holds p->lock.
+static void
+place_wakeup(struct proc *p)
+{
+  uint64 min = __atomic_load_n(&min_vruntime, __ATOMIC_RELAXED);
+
+  p->rtseq = __atomic_fetch_add(&rtseq_next, 1, __ATOMIC_RELAXED);
+  if(min > SCHED_LATENCY && p->vruntime < min - SCHED_LATENCY)
+    p->vruntime = min - SCHED_LATENCY;
+}
+
+// Priority of whatever c is running: the rtprio of a real-time
+// process, 0 for a normal one or none. Unlocked peek.
+static int
+cpu_prio(struct cpu *c)
+{
+  struct proc *p = c->proc;
+
+  if(p == 0 || p->policy != SCHED_FIFO)
+    return 0;
+  return p->rtprio;
+}
+
+// Called after p has become RUNNABLE, without p->lock.
+// Wake an idle hart for it; failing that, if p is real-time,
+// preempt the lowest-priority process on a hart p may run on.
+// This hart is preferred: it needs no IPI, only need_resched,
+// which usertrap()/kerneltrap() honour on their way out.
+static void
+wake_kick(struct proc *p)
+{
+  struct cpu *self, *c, *victim;
+  int prio;
+
+  if(ipi_kick(p) || p->policy != SCHED_FIFO)
+    return;
+
+  push_off();
+  self = mycpu();
+  prio = p->rtprio;
+  victim = 0;
+  if((p->pincpu == 0 || p->pincpu == self) && cpu_prio(self) < prio){
+    victim = self;
+  } else if(p->pincpu){
+    if(cpu_prio(p->pincpu) < prio)
+      victim = p->pincpu;
+  } else {
+    for(c = cpus; c < &cpus[NCPU]; c++){
+      if(c->proc && cpu_prio(c) < prio && (victim == 0 || cpu_prio(c) < cpu_prio(victim)))
+        victim = c;
+    }
   }
+  if(victim == self)
+    self->need_resched = 1;
+  else if(victim)
+    ipi_send(victim - cpus, IPI_RESCHED);
+  pop_off();
+}
+
+// Should the process on this hart give up the CPU at trap return?
+int
+need_resched(void)
+{
+  int r;
+
+  push_off();
+  r = mycpu()->need_resched;
+  pop_off();
+  return r;
+}
+
+// May p run on c?
+static int
+runs_on(struct proc *p, struct cpu *c)
+{
+// LAB_LOCK
+  if(p->pincpu && p->pincpu != c)
+    return 0;
+// END LAB_LOCK
+  return 1;
+}
+
+// Choose the next process for c. Real-time processes come first:
+// the highest rtprio, and among equals the one that became
+// RUNNABLE earliest. Otherwise the RUNNABLE process with the
+// smallest vruntime. The scan peeks at the fields without locks;
+// the winner is then locked and rechecked, and the scan repeats
+// if it was taken by another hart meanwhile.
+// Returns with p->lock held, or 0 if nothing is runnable.
+static struct proc*
+pick_next(struct cpu *c)
+{
+  struct proc *p, *best, *rt;
+  uint64 min;
+
+  for(;;){
+    best = rt = 0;
+    for_each_proc(p){
+      if(__atomic_load_n(&p->state, __ATOMIC_RELAXED) != RUNNABLE)
+        continue;
+      if(!runs_on(p, c))
+        continue;
+      if(p->policy == SCHED_FIFO){
+        if(rt == 0 || p->rtprio > rt->rtprio ||
+           (p->rtprio == rt->rtprio && (long)(p->rtseq - rt->rtseq) < 0))
+          rt = p;
+      } else if(best == 0 || (long)(p->vruntime - best->vruntime) < 0){
+        best = p;
+      }
+    }
+    if(rt)
+      best = rt;
+    if(best == 0)
+      return 0;
+
+    acquire(&best->lock);
+    if(best->state == RUNNABLE && runs_on(best, c))
+      break;
+    release(&best->lock);
+  }
+
+  if(best->policy != SCHED_OTHER)
+    return best;
+
+  // advance min_vruntime, never backwards.
+  min = __atomic_load_n(&min_vruntime, __ATOMIC_RELAXED);
+  while((long)(best->vruntime - min) > 0 &&
+        !__atomic_compare_exchange_n(&min_vruntime, &min, best->vruntime, 0,
+                                     __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+  return best;
 }
 
 // Per-CPU process scheduler.
@@ -482,34 +1400,39 @@ scheduler(void)
     intr_on();
     intr_off();
 
-    int nproc = 0;
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if (p->state != UNUSED) {
-        ++nproc;
-      }
-// LAB_LOCK
-      if(p->pincpu && p->pincpu != c) {
-        release(&p->lock);
-        continue;
-      }
-// END LAB_LOCK
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+    rcu_sched();
+
+    // announce that this hart is idle before scanning, so that a
+    // wakeup() racing with the scan sends an IPI; a kick that
+    // arrives before the wfi below leaves sip.SSIP pending and
+    // the wfi falls straight through.
+    c->idle = 1;
+    c->need_resched = 0;
+    p = pick_next(c);
+    if(p) {
+      // Switch to chosen process.  It is the process's job
+      // to release its lock and then reacquire it
+      // before jumping back to us.
+      p->state = RUNNING;
+      c->idle = 0;
+      c->proc = p;
+      // p's kernel stack may have been mapped after this hart
+      // last flushed its TLB.
+      if(c->kstackgen != __atomic_load_n(&kstackgen, __ATOMIC_ACQUIRE)){
+        c->kstackgen = kstackgen;
+        sfence_vma();
       }
+      p->exec_start = r_time();
+      swtch(&c->context, &p->context);
+
+      // Process is done running for now.
+      // It should have changed its p->state before coming back.
+      c->proc = 0;
+      charge_vruntime(p);
       release(&p->lock);
-    }
-    if(nproc <= 2) {   // only init and sh exist
-      // nothing to run; stop running on this core until an interrupt.
+    } else {
+      // nothing to run; stop running on this core until an
+      // interrupt: a device, the timer, or an IPI from ipi_kick().
       intr_on();
 #ifndef LAB_FS
       asm volatile("wfi");
@@ -552,6 +1475,7 @@ yield(void)
   struct proc *p = myproc();
   acquire(&p->lock);
   p->state = RUNNABLE;
+  p->rtseq = __atomic_fetch_add(&rtseq_next, 1, __ATOMIC_RELAXED);
   sched();
   release(&p->lock);
 }
@@ -631,11 +1555,15 @@ wakeup(void *chan)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++) {
+  for_each_proc(p){
     if(p != myproc()){
       acquire(&p->lock);
       if(p->state == SLEEPING && p->chan == chan) {
         p->state = RUNNABLE;
+        place_wakeup(p);
+        release(&p->lock);
+        wake_kick(p);
+        continue;
       }
       release(&p->lock);
     }
@@ -650,20 +1578,99 @@ kkill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  if((p = pid_lookup(pid)) == 0)
+    return -1;
+  if(p->kfn){
     release(&p->lock);
+    return -1;
+  }
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    p->state = RUNNABLE;
+    place_wakeup(p);
+    release(&p->lock);
+    wake_kick(p);
+    return 0;
+  }
+  release(&p->lock);
+  return 0;
+}
+
+// Set the nice value of the process with the given pid.
+int
+setnice(int pid, int nice)
+{
+  struct proc *p;
+
+  if((p = pid_lookup(pid)) == 0)
+    return -1;
+  p->nice = nice;
+  release(&p->lock);
+  return 0;
+}
+
+// Return the nice value of the process with the given pid,
+// or NICE_MIN-1 if there is no such process.
+int
+getnice(int pid)
+{
+  struct proc *p;
+  int nice;
+
+  if((p = pid_lookup(pid)) == 0)
+    return NICE_MIN - 1;
+  nice = p->nice;
+  release(&p->lock);
+  return nice;
+}
+
+// Set the scheduling policy of the process with the given pid.
+int
+setscheduler(int pid, int policy, int rtprio)
+{
+  struct proc *p;
+
+  if((p = pid_lookup(pid)) == 0)
+    return -1;
+  if(p->policy == SCHED_FIFO && policy == SCHED_OTHER){
+    // rejoin the fair queue without a stale vruntime.
+    p->vruntime = __atomic_load_n(&min_vruntime, __ATOMIC_RELAXED);
   }
-  return -1;
+  p->policy = policy;
+  p->rtprio = rtprio;
+  release(&p->lock);
+  return 0;
+}
+
+// Return the scheduling policy of the process with the given pid,
+// or -1 if there is no such process.
+int
+getscheduler(int pid)
+{
+  struct proc *p;
+  int policy;
+
+  if((p = pid_lookup(pid)) == 0)
+    return -1;
+  policy = p->policy;
+  release(&p->lock);
+  return policy;
+}
+
+// Return the pid of the current process's parent, 0 if none
+// (init and threads).
+int
+getppid(void)
+{
+  struct proc *pp;
+  int pid;
+
+  if((pp = lock_parent(myproc())) == 0)
+    return 0;
+  pid = pp->pid;
+  release(&pp->childlock);
+  return pid;
 }
 
 void
@@ -733,7 +1740,7 @@ procdump(void)
   char *state;
 
   printf("\n");
-  for(p = proc; p < &proc[NPROC]; p++){
+  for_each_proc(p){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -751,7 +1758,7 @@ proccount(uint64* count)
 {
   *count = 0;
   struct proc* p;
-  for(p = proc; p < &proc[NPROC]; ++p){
+  for_each_proc(p){
     if(p->state != UNUSED){
       (*count)++;
     }
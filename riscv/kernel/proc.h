@@ -24,10 +24,22 @@ struct cpu {
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  volatile int idle;          // Parked in scheduler()'s wfi; ipi_kick() may claim it.
+  volatile int ipi_pending;   // IPI_* requests posted by other harts.
+  volatile uint64 tlbdone;    // Last TLB shootdown ticket flushed, see ipi.c.
+  volatile int need_resched;  // Give up the current process at the next trap return.
+  uint64 kstackgen;           // Kernel stacks mapped as of this hart's last sfence.vma.
+  int online;                 // This hart has entered scheduler().
+  uint64 rcu_qs;              // Last RCU grace period this hart was quiescent in.
 };
 
 extern struct cpu cpus[NCPU];
 
+// cpu->ipi_pending request bits, see ipi.c.
+#define IPI_RESCHED   (1 << 0)  // new work may be runnable here
+#define IPI_TLBFLUSH  (1 << 1)  // flush this hart's TLB and ack
+#define IPI_RCU       (1 << 2)  // report a quiescent state, see rcu.c
+
 // per-process data for the trap handling code in trampoline.S.
 // sits in a page by itself just under the trampoline page in the
 // user page table. not specially mapped in the kernel page table.
@@ -110,7 +122,27 @@ struct shm_region {
   int marked_for_deletion;      // 标记是否等待删除
 };
 
-// Per-process state
+// 线程共享的地址空间信息。ref 由 tg_lock 保护（见 proc.c），
+// 包括尚未被 join 回收的僵尸线程。存放在首线程的 struct proc
+// 中，首线程总是最后一个被回收。
+struct mm {
+  struct spinlock lock;        // 保护 slots 和 sz，并串行化 growproc
+  int ref;                     // 使用此地址空间的线程数
+  uint64 slots;                // 已占用的 trapframe 槽位，第 k 位对应 THREADFRAME(k)
+  uint64 sz;                   // 进程内存大小（字节），所有线程共用；不持锁也可读
+};
+
+// 线程共享的打开文件表，ref 由 tg_lock 保护。
+struct files {
+  struct spinlock lock;        // 保护 ofile[] 的分配与释放
+  int ref;
+  struct file *ofile[NOFILE];
+};
+
+// Per-process state.
+// Allocated from a slab in proc.c and never returned to kalloc(),
+// so a stale pointer still points at some struct proc: lockless
+// peeks (scheduler, lock_parent()) must lock and recheck.
 struct proc {
   struct spinlock lock;
 
@@ -121,18 +153,37 @@ struct proc {
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
 
-  // wait_lock must be held when using this:
+  // pid_lock must be held when using these:
+  struct proc *allnext;        // Live process list; left intact on removal
+  struct proc **allpprev;
+  struct proc *pidnext;        // Pid hash chain
+  struct proc *freenext;       // Slab free list (procslab_lock)
+
+  // parent->childlock must be held when using these:
   struct proc *parent;         // Parent process
+  struct proc *sibling;        // Next in parent's children or zombies list
+  struct proc **psibling;      // Link that points at us, for O(1) removal
+
+  // p->childlock must be held when using these:
+  struct spinlock childlock;
+  struct proc *children;       // Live children
+  struct proc *zombies;        // Exited children not yet waited for
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
-  uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
   struct context context;      // swtch() here to run process
-  struct file *ofile[NOFILE];  // Open files
+  struct file **ofile;         // Open files, files->ofile
+  struct files *files;         // Open file table, shared by threads
+  struct mm *mm;               // Address space, shared by threads
+  int thread;                  // Created by clone(), not the process's first thread
+  void (*kfn)(void);           // Kernel thread body; 0 for user processes
+  uint64 tfva;                 // User virtual address of this thread's trapframe
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct mm mm0;               // mm and files of a process whose
+  struct files files0;         //   first thread this is
 
   uint64 trace_mask;        //存储进程的系统调用跟踪掩码,用于控制哪些系统调用需要被跟踪
   struct vm_area vma[NVMA]; // 虚拟内存区域
@@ -148,4 +199,18 @@ struct proc {
 // LAB_LOCK
   struct cpu *pincpu;
 // END LAB_LOCK
+
+  // 调度，p->lock 保护
+  int policy;                  // SCHED_OTHER 或 SCHED_FIFO
+  int rtprio;                  // SCHED_FIFO 优先级 1..99，越大越优先
+  uint64 rtseq;                // 变为 RUNNABLE 的先后，同优先级先来先服务
+  int nice;                    // -20（最高）.. 19（最低）
+  uint64 vruntime;             // 按权重折算的运行时间（time 计数）
+  uint64 exec_start;           // 本次被调度上 CPU 时的 r_time()
+
+  // CPU 时间（时钟滴答），utime/stime 只由进程自己更新
+  uint64 utime;                // 用户态
+  uint64 stime;                // 内核态
+  uint64 cutime;               // 已回收子进程的 utime 之和
+  uint64 cstime;               // 已回收子进程的 stime 之和
 };
@@ -0,0 +1,149 @@
+// Read-copy-update, quiescent-state based.
+//
+// A read-side critical section runs with interrupts off, so it can
+// neither be preempted nor sleep. Hence every time a hart passes
+// through scheduler(), or takes an interrupt, all of its earlier
+// readers are done: that is a quiescent state. A grace period
+// numbered g is over once every online hart has recorded a
+// quiescent state after g began (cpu->rcu_qs >= g).
+//
+// synchronize_rcu() starts a grace period and IPIs the harts that
+// lag behind so it does not have to wait for their next timer tick.
+// call_rcu() queues a callback that scheduler() runs once its grace
+// period is over. Every RCU_KICKCB callbacks queued, it IPIs the
+// lagging harts too, so a hart that never reschedules (a SCHED_FIFO
+// hog) cannot hold up reclamation for long.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+#include "rcu.h"
+
+static uint64 rcu_gp;                    // 最近开始的宽限期编号
+
+static struct spinlock rcu_lock;         // 保护回调队列
+static struct rcu_head *rcu_cbhead;      // 按宽限期编号递增排列
+static struct rcu_head **rcu_cbtail = &rcu_cbhead;
+static int rcu_ncb;                      // 队列中的回调数
+
+#define RCU_KICKCB 64                    // 积压这么多回调就催一次
+
+void
+rcuinit(void)
+{
+  initlock(&rcu_lock, "rcu");
+}
+
+void
+rcu_read_lock(void)
+{
+  push_off();
+}
+
+void
+rcu_read_unlock(void)
+{
+  pop_off();
+}
+
+// 本 hart 处于静止状态：之前的读者都已结束。
+// 由 scheduler() 和 ipi_intr() 调用，中断必须是关的。
+void
+rcu_qs(void)
+{
+  struct cpu *c = mycpu();
+
+  __atomic_store_n(&c->rcu_qs, __atomic_load_n(&rcu_gp, __ATOMIC_SEQ_CST),
+                   __ATOMIC_SEQ_CST);
+}
+
+static int
+rcu_gp_done(uint64 gp, int kick)
+{
+  int done = 1;
+
+  for(struct cpu *c = cpus; c < &cpus[NCPU]; c++){
+    if(!c->online || __atomic_load_n(&c->rcu_qs, __ATOMIC_SEQ_CST) >= gp)
+      continue;
+    done = 0;
+    if(kick)
+      ipi_send(c - cpus, IPI_RCU);
+  }
+  return done;
+}
+
+// 等到此前开始的所有读者都结束。调用者不能在读临界区里。
+void
+synchronize_rcu(void)
+{
+  uint64 gp = __atomic_add_fetch(&rcu_gp, 1, __ATOMIC_SEQ_CST);
+  int kick = 1;
+
+  push_off();
+  rcu_qs();
+  pop_off();
+  while(!rcu_gp_done(gp, kick)){
+    kick = 0;
+    yield();
+  }
+}
+
+// 一个宽限期之后在 scheduler() 里调用 head->func(head)。
+// 可以在读临界区或持有自旋锁时调用。
+void
+call_rcu(struct rcu_head *head, void (*func)(struct rcu_head *))
+{
+  int kick;
+
+  head->func = func;
+  head->next = 0;
+  acquire(&rcu_lock);
+  head->gp = __atomic_add_fetch(&rcu_gp, 1, __ATOMIC_SEQ_CST);
+  *rcu_cbtail = head;
+  rcu_cbtail = &head->next;
+  kick = ++rcu_ncb % RCU_KICKCB == 0;
+  release(&rcu_lock);
+
+  // 积压多了就让还没报告的 hart 报告静止状态，
+  // 它们的 rcu_qs 会赶上 head->gp，前面的回调也随之可以执行。
+  if(kick)
+    rcu_gp_done(head->gp, 1);
+}
+
+// 记录静止状态并执行宽限期已过的回调。由 scheduler() 调用。
+void
+rcu_sched(void)
+{
+  struct rcu_head *done, *h, **pp;
+
+  rcu_qs();
+  if(__atomic_load_n(&rcu_cbhead, __ATOMIC_RELAXED) == 0)
+    return;
+
+  // 宽限期按顺序结束，取下队首已经可以执行的一段。
+  acquire(&rcu_lock);
+  pp = &rcu_cbhead;
+  while(*pp && rcu_gp_done((*pp)->gp, 0))
+    pp = &(*pp)->next;
+  done = 0;
+  if(pp != &rcu_cbhead){
+    for(h = rcu_cbhead; h != *pp; h = h->next)
+      rcu_ncb--;
+    done = rcu_cbhead;
+    rcu_cbhead = *pp;
+    *pp = 0;
+    if(rcu_cbhead == 0)
+      rcu_cbtail = &rcu_cbhead;
+  }
+  release(&rcu_lock);
+
+  while(done){
+    h = done;
+    done = h->next;
+    h->func(h);
+  }
+}
@@ -0,0 +1,17 @@
+// Read-copy-update.
+//
+// 读者用 rcu_read_lock()/rcu_read_unlock() 包住对共享指针的访问，
+// 期间不能睡眠。写者发布新对象用 rcu_assign_pointer()，摘除旧对象
+// 后用 synchronize_rcu() 等待或 call_rcu() 延后释放。
+
+struct rcu_head {
+  struct rcu_head *next;
+  uint64 gp;                        // 需要等待的宽限期
+  void (*func)(struct rcu_head *);
+};
+
+// 读者取指针：保证看到指针之后再读对象的内容
+#define rcu_dereference(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+// 写者发布指针：对象初始化完成后才对读者可见
+#define rcu_assign_pointer(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
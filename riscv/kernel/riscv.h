@@ -61,6 +61,14 @@ w_sstatus(uint64 x)
   asm volatile("csrw sstatus, %0" : : "r" (x));
 }
 
+// Supervisor Scratch register, holds the trapframe address
+// of the current thread while in user space.
+static inline void 
+w_sscratch(uint64 x)
+{
+  asm volatile("csrw sscratch, %0" : : "r" (x));
+}
+
 // Supervisor Interrupt Pending
 static inline uint64
 r_sip()
@@ -76,9 +84,12 @@ w_sip(uint64 x)
   asm volatile("csrw sip, %0" : : "r" (x));
 }
 
+#define SIP_SSIP (1L << 1) // software interrupt pending
+
 // Supervisor Interrupt Enable
 #define SIE_SEIE (1L << 9) // external
 #define SIE_STIE (1L << 5) // timer
+#define SIE_SSIE (1L << 1) // software (IPI)
 static inline uint64
 r_sie()
 {
@@ -273,6 +284,21 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor Counter Enable: which counters U-mode may read
+static inline void 
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -282,6 +308,15 @@ r_time()
   return x;
 }
 
+// 本 hart 的 cycle 计数器，S 态读取需要 mcounteren.CY
+static inline uint64
+r_cycle()
+{
+  uint64 x;
+  asm volatile("csrr %0, cycle" : "=r" (x) );
+  return x;
+}
+
 // enable device interrupts
 static inline void
 intr_on()
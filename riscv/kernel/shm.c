@@ -151,6 +151,10 @@ shmat(int shmid, const void *addr, int shmflg)
   struct proc *p = myproc();
   struct shm_region *region = 0;
   
+  // 附加记录是每个线程私有的，多线程进程不支持
+  if(p->mm->ref > 1)
+    return (void*)-1;
+
   // 按照锁顺序，先获取进程锁
   acquire(&p->lock);
   
@@ -184,7 +188,7 @@ shmat(int shmid, const void *addr, int shmflg)
   uint64 va;
   if(addr == 0) {
     // 由内核选择地址
-    va = p->sz;
+    va = p->mm->sz;
   } else {
     // 使用指定的地址
     va = (uint64)addr;
@@ -225,8 +229,8 @@ shmat(int shmid, const void *addr, int shmflg)
   p->shm_attached[attach_idx].va = va;
 
   // 如果需要，更新进程大小
-  if(va + size > p->sz) {
-    p->sz = va + size;
+  if(va + size > p->mm->sz) {
+    p->mm->sz = va + size;
   }
 
   release(&region->lock);
@@ -1,13 +1,37 @@
+// 自旋锁的实现在编译时选择（见 Makefile 的 SPINLOCK 变量）：
+//   SPINLOCK_TICKET  排号锁，按到达顺序获得锁（默认）
+//   SPINLOCK_MCS     MCS 队列锁，每个等待者只在自己的节点上自旋
+//   SPINLOCK_TAS     原来的 test-and-set 锁
+#if !defined(SPINLOCK_TICKET) && !defined(SPINLOCK_MCS) && !defined(SPINLOCK_TAS)
+#define SPINLOCK_TICKET
+#endif
+
+#ifdef SPINLOCK_MCS
+// MCS 队列节点，每个 CPU 一组，独占一条 cache line。
+struct mcs_node {
+  struct mcs_node *next;   // 排在后面的等待者
+  int locked;              // 1 表示还在等，前驱放锁时清 0
+} __attribute__((aligned(64)));
+#endif
+
 // Mutual exclusion lock.
 struct spinlock {
+#if defined(SPINLOCK_TICKET)
+  uint next;         // 下一个要发出的号
+  uint owner;        // 当前持有锁的号；owner != next 表示已加锁
+#elif defined(SPINLOCK_MCS)
+  struct mcs_node *tail;   // 队尾；非 0 表示已加锁
+  struct mcs_node *node;   // 持有者的节点，release() 用
+#else
   uint locked;       // Is the lock held?
+#endif
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
 // LAB_LOCK
-  int nts;
-  int n;
+  struct lockclass *cls;   // 统计计数所在的锁类，见 spinlock.c
+  uint64 tacquire;         // 获得锁时的 cycle 计数
 // END LAB_LOCK
 };
 
@@ -30,7 +30,7 @@ start()
   // delegate all interrupts and exceptions to supervisor mode.
   w_medeleg(0xffff);
   w_mideleg(0xffff);
-  w_sie(r_sie() | SIE_SEIE | SIE_STIE);
+  w_sie(r_sie() | SIE_SEIE | SIE_STIE | SIE_SSIE);
 
   // configure Physical Memory Protection to give supervisor mode
   // access to all of physical memory.
@@ -58,8 +58,11 @@ timerinit()
   // enable the sstc extension (i.e. stimecmp).
   w_menvcfg(r_menvcfg() | (1L << 63)); 
   
-  // allow supervisor to use stimecmp and time.
-  w_mcounteren(r_mcounteren() | 2);
+  // allow supervisor to use stimecmp and time, and cycle for lock stats.
+  w_mcounteren(r_mcounteren() | 2 | 1);
+
+  // let user programs read time too (rdtime), for latency tests.
+  w_scounteren(r_scounteren() | 2);
   
   // ask for the very first timer interrupt.
   w_stimecmp(r_time() + 1000000);
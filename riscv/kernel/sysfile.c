@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "memlayout.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -42,12 +43,16 @@ fdalloc(struct file *f)
   int fd;
   struct proc *p = myproc();
 
+  // the table may be shared with other threads.
+  acquire(&p->files->lock);
   for(fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd] == 0){
       p->ofile[fd] = f;
+      release(&p->files->lock);
       return fd;
     }
   }
+  release(&p->files->lock);
   return -1;
 }
 
@@ -94,15 +99,41 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Wait until the file system changes made so far, to this
+// file or any other, are on disk. There is one log for the
+// whole file system; the file's delayed blocks are flushed
+// first.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type == FD_INODE)
+    iflush(f->ip);
+  log_force();
+  return 0;
+}
+
 uint64
 sys_close(void)
 {
   int fd;
   struct file *f;
 
+  struct proc *p = myproc();
+
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  // another thread may have closed it meanwhile.
+  acquire(&p->files->lock);
+  if(p->ofile[fd] != f){
+    release(&p->files->lock);
+    return -1;
+  }
+  p->ofile[fd] = 0;
+  release(&p->files->lock);
   fileclose(f);
   return 0;
 }
@@ -411,7 +442,6 @@ sys_chdir(void)
 {
   char path[MAXPATH];
   struct inode *ip;
-  struct proc *p = myproc();
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -425,9 +455,9 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
+  // the current directory is shared by all threads.
+  setcwd(ip);
   end_op();
-  p->cwd = ip;
   return 0;
 }
 
@@ -438,6 +468,10 @@ sys_exec(void)
   int i;
   uint64 uargv, uarg;
 
+  // the other threads would lose their address space.
+  if(myproc()->mm->ref > 1)
+    return -1;
+
   argaddr(1, &uargv);
   if(argstr(0, path, MAXPATH) < 0) {
     return -1;
@@ -534,8 +568,12 @@ sys_mmap(void)
     return err;
 
   struct proc *p = myproc();
+  // VMA 是每个线程私有的，多线程进程不支持 mmap
+  if (p->mm->ref > 1)
+    return err;
+
   // 没有足够的虚拟地址空间
-  if (p->sz + length > MAXVA)
+  if (p->mm->sz + length > USERTOP)
     return err;
 
   // 遍历查找未使用的VMA结构体
@@ -544,7 +582,7 @@ sys_mmap(void)
     if (p->vma[i].used == 0)
     {
       p->vma[i].used = 1;
-      p->vma[i].addr = p->sz;
+      p->vma[i].addr = p->mm->sz;
       p->vma[i].len = length;
       p->vma[i].flags = flags;
       p->vma[i].prot = prot;
@@ -555,7 +593,7 @@ sys_mmap(void)
       // 增加文件的引用计数
       filedup(vfile);
 
-      p->sz += length;
+      p->mm->sz += length;
       return p->vma[i].addr;
     }
   }
@@ -21,6 +21,7 @@
 #define SYS_read       63    // 从文件描述符读取
 #define SYS_write      64    // 向文件描述符写入
 #define SYS_fstat      80    // 获取文件状态
+#define SYS_fsync      82    // 等文件系统的修改写到盘上
 
 // 进程管理相关
 #define SYS_fork        1    // 创建子进程 [自定义]
@@ -31,8 +32,13 @@
 #define SYS_sleep      13    // 使进程休眠（秒） [自定义]
 #define SYS_pause      33    // 暂停进程 [自定义]
 #define SYS_exit       93    // 进程退出
+#define SYS_futex      98    // 用户态同步原语
 #define SYS_nanosleep 101    // 线程睡眠（纳秒精度）
+#define SYS_sched_setscheduler 119 // 设置调度策略
+#define SYS_sched_getscheduler 120 // 获取调度策略
 #define SYS_sched_yield 124  // 让出调度器
+#define SYS_setpriority 140  // 设置进程 nice 值
+#define SYS_getpriority 141  // 获取进程 nice 值
 #define SYS_times      153   // 获取进程时间
 #define SYS_uname      160   // 获取系统信息
 #define SYS_gettimeofday 169 // 获取时间
@@ -82,4 +88,14 @@
 #define SYS_shmdt     539
 #define SYS_shmctl    540
 
+// 线程
+#define SYS_join      541
+
+// LAB_LOCK 锁吞吐量测试
+#define SYS_lockbench 542
+
+// 磁盘轮询模式和延迟测试
+#define SYS_diskpoll  543
+#define SYS_disklat   544
+
 #endif // _SYS_H
\ No newline at end of file
@@ -8,6 +8,7 @@
 #include "vm.h"
 
 #include "sysinfo.h"
+#include "times.h"
 
 uint64
 sys_exit(void)
@@ -24,6 +25,12 @@ sys_getpid(void)
   return myproc()->pid;
 }
 
+uint64
+sys_getppid(void)
+{
+  return getppid();
+}
+
 uint64
 sys_fork(void)
 {
@@ -35,7 +42,21 @@ sys_wait(void)
 {
   uint64 p;
   argaddr(0, &p);
-  return kwait(p);
+  return kwait(-1, p, 0);
+}
+
+// wait4(pid, &status, options, rusage)：等待指定子进程（pid > 0）
+// 或任意子进程。rusage 不支持，忽略。
+uint64
+sys_wait4(void)
+{
+  int pid, options;
+  uint64 p;
+
+  argint(0, &pid);
+  argaddr(1, &p);
+  argint(2, &options);
+  return kwait(pid, p, options);
 }
 
 uint64
@@ -47,7 +68,7 @@ sys_sbrk(void)
 
   argint(0, &n);
   argint(1, &t);
-  addr = myproc()->sz;
+  addr = myproc()->mm->sz;
 
   if(t == SBRK_EAGER || n < 0) {
     if(growproc(n) < 0) {
@@ -57,11 +78,7 @@ sys_sbrk(void)
     // Lazily allocate memory for this process: increase its memory
     // size but don't allocate memory. If the processes uses the
     // memory, vmfault() will allocate it.
-    if(addr + n < addr)
-      return -1;
-    if(addr + n > TRAPFRAME)
-      return -1;
-    myproc()->sz += n;
+    addr = growproc_lazy(n);
   }
   return addr;
 }
@@ -186,11 +203,150 @@ sys_cpupin(void)
   int cpu;
 
   argint(0, &cpu);
-  if (cpu < 0 || cpu >= NCPU)
+  // 没有启动的 hart 永远不会调度这个进程。
+  if (cpu < 0 || cpu >= NCPU || !cpus[cpu].online)
     return -1;
   acquire(&p->lock);
   p->pincpu = &cpus[cpu];
   release(&p->lock);
   return 0;
 }
-// END LAB_LOCK
\ No newline at end of file
+// END LAB_LOCK
+
+// 进程及已回收子进程消耗的 CPU 时间，返回开机以来的时钟滴答数
+uint64
+sys_times(void)
+{
+  struct proc *p = myproc();
+  struct tms tms;
+  uint64 addr;
+  uint xticks;
+
+  argaddr(0, &addr);
+  tms.tms_utime = p->utime;
+  tms.tms_stime = p->stime;
+  tms.tms_cutime = p->cutime;
+  tms.tms_cstime = p->cstime;
+  if(addr != 0 && copyout(p->pagetable, addr, (char *)&tms, sizeof(tms)) < 0)
+    return -1;
+
+  acquire(&tickslock);
+  xticks = ticks;
+  release(&tickslock);
+  return xticks;
+}
+
+// setpriority(PRIO_PROCESS, pid, nice)，pid 为 0 表示自己。
+// nice 超出 [-20, 19] 时截断。
+uint64
+sys_setpriority(void)
+{
+  int which, who, prio;
+
+  argint(0, &which);
+  argint(1, &who);
+  argint(2, &prio);
+  if(which != PRIO_PROCESS)
+    return -1;
+  if(prio < NICE_MIN)
+    prio = NICE_MIN;
+  if(prio > NICE_MAX)
+    prio = NICE_MAX;
+  return setnice(who ? who : myproc()->pid, prio);
+}
+
+// getpriority(PRIO_PROCESS, pid)，与 Linux 系统调用一致返回
+// 20 - nice（1..40），以便与出错的 -1 区分。
+uint64
+sys_getpriority(void)
+{
+  int which, who;
+
+  argint(0, &which);
+  argint(1, &who);
+  if(which != PRIO_PROCESS)
+    return -1;
+  int nice = getnice(who ? who : myproc()->pid);
+  if(nice < NICE_MIN)
+    return -1;
+  return 20 - nice;
+}
+
+// sched_setscheduler(pid, policy, rtprio)，pid 为 0 表示自己。
+// 与 Linux 不同，优先级直接以整数传入而不是 struct sched_param。
+uint64
+sys_sched_setscheduler(void)
+{
+  int pid, policy, rtprio;
+
+  argint(0, &pid);
+  argint(1, &policy);
+  argint(2, &rtprio);
+  if(policy == SCHED_OTHER){
+    rtprio = 0;
+  } else if(policy == SCHED_FIFO){
+    if(rtprio < RTPRIO_MIN || rtprio > RTPRIO_MAX)
+      return -1;
+  } else {
+    return -1;
+  }
+  return setscheduler(pid ? pid : myproc()->pid, policy, rtprio);
+}
+
+// sched_getscheduler(pid)，返回调度策略。
+uint64
+sys_sched_getscheduler(void)
+{
+  int pid;
+
+  argint(0, &pid);
+  return getscheduler(pid ? pid : myproc()->pid);
+}
+
+// clone(fn, arg, stack)：创建与调用者共享地址空间、打开文件和
+// 当前目录的线程，从 fn(arg) 开始运行，stack 为用户栈顶。
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  argaddr(0, &fn);
+  argaddr(1, &arg);
+  argaddr(2, &stack);
+  if(stack == 0 || stack % 16 != 0)
+    return -1;
+  return kclone(fn, arg, stack);
+}
+
+// join(tid, &status)：等待本进程的线程 tid 退出并回收它。
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 addr;
+
+  argint(0, &tid);
+  argaddr(1, &addr);
+  return kjoin(tid, addr);
+}
+
+// 主动让出 CPU
+uint64
+sys_sched_yield(void)
+{
+  yield();
+  return 0;
+}
+
+// futex(addr, op, val)：见 futex.c
+uint64
+sys_futex(void)
+{
+  uint64 addr;
+  int op, val;
+
+  argaddr(0, &addr);
+  argint(1, &op);
+  argint(2, &val);
+  return futex(addr, op, val);
+}
@@ -0,0 +1,20 @@
+// SYS_times 返回的进程 CPU 时间，单位为时钟滴答
+struct tms {
+  uint64 tms_utime;   // 用户态时间
+  uint64 tms_stime;   // 内核态时间
+  uint64 tms_cutime;  // 已回收子进程的用户态时间
+  uint64 tms_cstime;  // 已回收子进程的内核态时间
+};
+
+// setpriority()/getpriority() 的 which 参数
+#define PRIO_PROCESS 0
+
+#define NICE_MIN (-20)
+#define NICE_MAX 19
+
+// sched_setscheduler()/sched_getscheduler() 的调度策略
+#define SCHED_OTHER 0   // 普通进程，按 nice 加权公平调度
+#define SCHED_FIFO  1   // 实时进程，优先于所有普通进程，不按时间片抢占
+
+#define RTPRIO_MIN 1
+#define RTPRIO_MAX 99
@@ -8,6 +8,7 @@
 #include "fs.h"
 #include "file.h"
 #include "defs.h"
+#include "times.h"
 #include "fcntl.h"
 
 struct spinlock tickslock;
@@ -111,7 +112,7 @@ usertrap(void)
         // 访问内核地址空间或超过MAXVA的地址，杀死进程
         printf("usertrap(): invalid address va=%p, pid=%d\n", (void*)va, p->pid);
         setkilled(p);
-      } else if(va >= p->sz) {
+      } else if(va >= p->mm->sz) {
         // 超出进程大小限制，杀死进程
         printf("usertrap(): address beyond process size va=%p, pid=%d\n", (void*)va, p->pid);
         setkilled(p);
@@ -132,8 +133,13 @@ done:
   if(killed(p))
     kexit(-1);
 
-  // give up the CPU if this is a timer interrupt.
+  // give up the CPU if this is a timer interrupt, unless this is
+  // a real-time process, which runs until it blocks or yields.
+  // a wakeup of a higher-priority real-time process preempts
+  // right away via need_resched.
   if(which_dev == 2)
+    p->utime++;
+  if((which_dev == 2 && p->policy == SCHED_OTHER) || need_resched())
     yield();
 
   prepare_return();
@@ -180,6 +186,9 @@ prepare_return(void)
 
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
+
+  // tell the trampoline where this thread's trapframe is mapped.
+  w_sscratch(p->tfva);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -203,9 +212,14 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0)
-    yield();
+  // give up the CPU if this is a timer interrupt, or a real-time
+  // process was woken for this hart.
+  if(myproc() != 0){
+    if(which_dev == 2)
+      myproc()->stime++;
+    if((which_dev == 2 && myproc()->policy == SCHED_OTHER) || need_resched())
+      yield();
+  }
 
   // the yield() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sepc instruction.
@@ -270,6 +284,10 @@ devintr()
     // timer interrupt.
     clockintr();
     return 2;
+  } else if(scause == 0x8000000000000001L){
+    // supervisor software interrupt: an IPI from another hart.
+    ipi_intr();
+    return 1;
   } else {
     return 0;
   }
@@ -47,7 +47,10 @@
 
 // this many virtio descriptors.
 // must be a power of two.
-#define NUM 8
+// a request for n blocks takes n+2 (header, one per block, status):
+// at least NUM/(MAXRUNBLOCKS+2) requests fit, and up to NUM/3
+// single-block ones.
+#define NUM 64
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -61,11 +64,12 @@ struct virtq_desc {
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
-  uint16 flags; // always zero
+  uint16 flags; // VRING_AVAIL_F_NO_INTERRUPT while polling
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
-  uint16 unused;
+  uint16 used_event; // EVENT_IDX: interrupt once the device has used this entry
 };
+#define VRING_AVAIL_F_NO_INTERRUPT 1 // avail flags, without EVENT_IDX
 
 // one entry in the "used" ring, with which the
 // device tells the driver about completed requests.
@@ -78,6 +82,7 @@ struct virtq_used {
   uint16 flags; // always zero
   uint16 idx;   // device increments when it adds a ring[] entry
   struct virtq_used_elem ring[NUM];
+  uint16 avail_event; // EVENT_IDX: notify once the driver has added this entry
 };
 
 // these are specific to virtio block devices, e.g. disks,
@@ -46,7 +46,8 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b[MAXRUNBLOCKS]; // consecutive blocks of one request
+    int n;
     char status;
   } info[NUM];
 
@@ -55,9 +56,26 @@ static struct disk {
   struct virtio_blk_req ops[NUM];
   
   struct spinlock vdisk_lock;
+
+  int event_idx;   // VIRTIO_RING_F_EVENT_IDX negotiated?
+  uint16 kick_idx; // avail->idx when the device was last notified
+  int pollus;      // submitters poll this long before sleeping; 0: never
+  int npoll;       // submitters polling now; interrupts are off meanwhile
+  uint64 nkick;    // notifies written
+  uint64 nnokick;  // notifies the device said it did not need
+  uint64 nintr;
+  uint64 npolled;  // requests completed by polling
   
 } disk;
 
+// EVENT_IDX: has idx moved past event, going from old to new?
+// (from the spec)
+static int
+vring_need_event(uint16 event, uint16 new, uint16 old)
+{
+  return (uint16)(new - event - 1) < (uint16)(new - old);
+}
+
 void
 virtio_disk_init(void)
 {
@@ -90,9 +108,9 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_CONFIG_WCE);
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
-  features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
   features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  disk.event_idx = (features >> VIRTIO_RING_F_EVENT_IDX) & 1;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -196,12 +214,12 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
+// a transfer of k blocks uses k+2 descriptors.
 static int
-alloc3_desc(int *idx)
+alloc_descs(int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
+  for(int i = 0; i < n; i++){
     idx[i] = alloc_desc();
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
@@ -212,53 +230,30 @@ alloc3_desc(int *idx)
   return 0;
 }
 
-// LAB_LOCK
-//
-// check that there are at most NBUF distinct
-// struct buf's, which the lock lab requires.
-//
-static struct buf *xbufs[NBUF];
-static void
-checkbuf(struct buf *b)
+// start a transfer of the n consecutive blocks bs[]: allocate and
+// fill in n+2 descriptors and hand the chain to the device.
+// returns -1, starting nothing, if there are not enough free
+// descriptors. caller holds disk.vdisk_lock.
+static int
+virtio_disk_start(struct buf **bs, int n, int write, void (*done)(struct buf *))
 {
-  for(int i = 0; i < NBUF; i++){
-    if(xbufs[i] == b){
-      return;
-    }
-    if(xbufs[i] == 0){
-      xbufs[i] = b;
-      return;
-    }
-  }
-  panic("more than NBUF bufs");
-}
-// END LAB_LOCK
+  uint64 sector = bs[0]->blockno * (BSIZE / 512);
+  int i;
 
-void
-virtio_disk_rw(struct buf *b, int write)
-{
-  uint64 sector = b->blockno * (BSIZE / 512);
-
-  acquire(&disk.vdisk_lock);
-
-// #ifdef LAB_LOCK
-  checkbuf(b);
-// #endif
+  if(n < 1 || n > MAXRUNBLOCKS)
+    panic("virtio_disk_start");
 
   // the spec's Section 5.2 says that legacy block operations use
   // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+  // data, one for a 1-byte status result. the data may also be
+  // spread over a chain of descriptors, one per buf here.
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
-    }
-    sleep(&disk.free[0], &disk.vdisk_lock);
-  }
+  // allocate the descriptors.
+  int idx[MAXRUNBLOCKS+2];
+  if(alloc_descs(idx, n+2) < 0)
+    return -1;
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
   struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
@@ -275,24 +270,30 @@ virtio_disk_rw(struct buf *b, int write)
   disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
   disk.desc[idx[0]].next = idx[1];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(i = 1; i <= n; i++){
+    disk.desc[idx[i]].addr = (uint64) bs[i-1]->data;
+    disk.desc[idx[i]].len = BSIZE;
+    if(write)
+      disk.desc[idx[i]].flags = 0; // device reads b->data
+    else
+      disk.desc[idx[i]].flags = VRING_DESC_F_WRITE; // device writes b->data
+    disk.desc[idx[i]].flags |= VRING_DESC_F_NEXT;
+    disk.desc[idx[i]].next = idx[i+1];
+  }
 
   disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
-
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  disk.desc[idx[n+1]].addr = (uint64) &disk.info[idx[0]].status;
+  disk.desc[idx[n+1]].len = 1;
+  disk.desc[idx[n+1]].flags = VRING_DESC_F_WRITE; // device writes the status
+  disk.desc[idx[n+1]].next = 0;
+
+  // record struct bufs for virtio_disk_intr().
+  for(i = 0; i < n; i++){
+    bs[i]->disk = 1;
+    bs[i]->done = done;
+    disk.info[idx[0]].b[i] = bs[i];
+  }
+  disk.info[idx[0]].n = n;
 
   // tell the device the first index in our chain of descriptors.
   disk.avail->ring[disk.avail->idx % NUM] = idx[0];
@@ -300,26 +301,231 @@ virtio_disk_rw(struct buf *b, int write)
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
+  // virtio_disk_kick() notifies it.
   disk.avail->idx += 1; // not % NUM ...
 
+  return 0;
+}
+
+// tell the device about the requests added since the last time,
+// unless, with EVENT_IDX, it has said it is still busy and will
+// look at the avail ring again without being told.
+// caller holds disk.vdisk_lock.
+static void
+virtio_disk_kick(void)
+{
+  uint16 old = disk.kick_idx, new = disk.avail->idx;
+
+  if(new == old)
+    return;
+  disk.kick_idx = new;
+
   __sync_synchronize();
 
+  if(disk.event_idx && !vring_need_event(disk.used->avail_event, new, old)){
+    disk.nnokick++;
+    return;
+  }
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+  disk.nkick++;
+}
+
+// finish all the requests in the used ring. synchronous callers
+// are woken here; bufs with a done() callback are added to the
+// list done, for the caller to call after releasing the lock.
+// caller holds disk.vdisk_lock.
+static struct buf*
+virtio_disk_reap(struct buf *done)
+{
+  struct buf *b;
+
+  // the device increments disk.used->idx when it
+  // adds an entry to the used ring.
+
+  while(disk.used_idx != disk.used->idx){
+    __sync_synchronize();
+    int id = disk.used->ring[disk.used_idx % NUM].id;
+
+    if(disk.info[id].status != 0)
+      panic("virtio_disk_intr status");
+
+    free_chain(id);
+    for(int i = 0; i < disk.info[id].n; i++){
+      b = disk.info[id].b[i];
+      disk.info[id].b[i] = 0;
+      b->disk = 0;   // disk is done with buf
+      if(b->done){
+        b->qnext = done;
+        done = b;
+      } else {
+        wakeup(b);
+      }
+    }
+
+    disk.used_idx += 1;
+
+    // with EVENT_IDX, ask for an interrupt at the next completion
+    // only now: entries the device adds while this loop runs do
+    // not interrupt. nobody wants interrupts while polling.
+    if(disk.event_idx && disk.npoll == 0)
+      disk.avail->used_event = disk.used_idx;
+    __sync_synchronize();
+  }
+  return done;
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
+// turn completion interrupts off while someone polls, and back on
+// after; anything that completed in between is reaped then.
+// caller holds disk.vdisk_lock.
+static struct buf*
+virtio_disk_poll_mode(int on, struct buf *done)
+{
+  if(on){
+    if(disk.npoll++ > 0)
+      return done;
+    if(disk.event_idx)
+      disk.avail->used_event = disk.used_idx - 1;  // a whole lap away
+    else
+      disk.avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
+  } else {
+    if(--disk.npoll > 0)
+      return done;
+    if(disk.event_idx)
+      disk.avail->used_event = disk.used_idx;
+    else
+      disk.avail->flags = 0;
   }
+  __sync_synchronize();
+  return virtio_disk_reap(done);
+}
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+static void
+virtio_disk_done(struct buf *done)
+{
+  struct buf *b;
+
+  while((b = done) != 0){
+    done = b->qnext;
+    b->done(b);
+  }
+}
+
+// start a transfer of b without waiting for it. the caller
+// keeps b locked; when the transfer is done, virtio_disk_intr()
+// clears b->disk and calls done(b), without disk.vdisk_lock held.
+// returns -1, starting nothing, if the queue is full.
+int
+virtio_disk_submit(struct buf *b, int write, void (*done)(struct buf *))
+{
+  return virtio_disk_submit_multi(&b, 1, write, done);
+}
+
+// like virtio_disk_submit(), for up to MAXRUNBLOCKS bufs holding
+// consecutive blocks, in one request. done() is called for each.
+int
+virtio_disk_submit_multi(struct buf **bs, int n, int write, void (*done)(struct buf *))
+{
+  int r;
+
+  acquire(&disk.vdisk_lock);
+  r = virtio_disk_start(bs, n, write, done);
+  virtio_disk_kick();
+  release(&disk.vdisk_lock);
+  return r;
+}
+
+static int
+pending(struct buf **bs, int n)
+{
+  for(int i = 0; i < n; i++)
+    if(bs[i]->disk)
+      return 1;
+  return 0;
+}
+
+// polled mode: a small request finishes in less time than an
+// interrupt and a wakeup take, so watch the used ring for up to
+// disk.pollus microseconds for bs[] to finish before sleeping.
+// the lock is dropped between looks. caller holds disk.vdisk_lock.
+static struct buf*
+virtio_disk_poll_locked(struct buf **bs, int n, struct buf *done)
+{
+  uint64 end;
+  uint16 i;
+
+  if(disk.pollus == 0 || !pending(bs, n))
+    return done;
+  end = r_time() + disk.pollus * 10;  // 时钟 10MHz
+  done = virtio_disk_poll_mode(1, done);
+  while(pending(bs, n) && r_time() < end){
+    release(&disk.vdisk_lock);
+    acquire(&disk.vdisk_lock);
+    i = disk.used_idx;
+    done = virtio_disk_reap(done);
+    disk.npolled += (uint16)(disk.used_idx - i);
+  }
+  return virtio_disk_poll_mode(0, done);
+}
+
+// virtio_disk_poll_locked() for requests started with
+// virtio_disk_submit(): returns when they are done, or
+// the polling time is up.
+void
+virtio_disk_poll(struct buf **bs, int n)
+{
+  struct buf *done;
+
+  acquire(&disk.vdisk_lock);
+  done = virtio_disk_poll_locked(bs, n, 0);
+  release(&disk.vdisk_lock);
+  virtio_disk_done(done);
+}
+
+// synchronous transfer of n bufs: each run of consecutive blocks
+// goes out as one request. all the runs are started, waiting for
+// room in the queue as needed, before waiting for them to finish.
+void
+virtio_disk_rw_multi(struct buf **bs, int n, int write)
+{
+  struct buf *done = 0;
+  int i, j;
+
+  acquire(&disk.vdisk_lock);
+
+  for(i = 0; i < n; i = j){
+    for(j = i + 1; j < n && j - i < MAXRUNBLOCKS; j++)
+      if(bs[j]->blockno != bs[j-1]->blockno + 1)
+        break;
+    while(virtio_disk_start(bs + i, j - i, write, 0) < 0){
+      virtio_disk_kick();
+      sleep(&disk.free[0], &disk.vdisk_lock);
+    }
+  }
+  virtio_disk_kick();
+
+  done = virtio_disk_poll_locked(bs, n, done);
+
+  // Wait for virtio_disk_intr() to say the requests have finished.
+  for(i = 0; i < n; i++)
+    while(bs[i]->disk == 1)
+      sleep(bs[i], &disk.vdisk_lock);
 
   release(&disk.vdisk_lock);
+
+  virtio_disk_done(done);
+}
+
+void
+virtio_disk_rw(struct buf *b, int write)
+{
+  virtio_disk_rw_multi(&b, 1, write);
 }
 
 void
 virtio_disk_intr()
 {
+  struct buf *done;
+
   acquire(&disk.vdisk_lock);
 
   // the device won't raise another interrupt until we tell it
@@ -332,22 +538,67 @@ virtio_disk_intr()
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
-  // adds an entry to the used ring.
+  disk.nintr++;
+  done = virtio_disk_reap(0);
 
-  while(disk.used_idx != disk.used->idx){
-    __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
+  release(&disk.vdisk_lock);
 
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
+  virtio_disk_done(done);
+}
 
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
+// set how long, in microseconds, synchronous disk requests poll
+// for completion before sleeping; 0 turns polling off.
+// returns the old setting.
+uint64
+sys_diskpoll(void)
+{
+  int us, old;
 
-    disk.used_idx += 1;
+  argint(0, &us);
+  if(us < 0 || us > 10000)
+    return -1;
+  acquire(&disk.vdisk_lock);
+  old = disk.pollus;
+  disk.pollus = us;
+  release(&disk.vdisk_lock);
+  return old;
+}
+
+// disk latency benchmark: read n blocks straight from the disk,
+// bypassing the buffer cache, one at a time. returns the total
+// time in microseconds.
+uint64
+sys_disklat(void)
+{
+  struct buf *b;
+  uint64 t0, tot = 0;
+  int n;
+
+  argint(0, &n);
+  if(n < 1 || n > 100000)
+    return -1;
+  if((b = kalloc()) == 0)
+    return -1;
+  memset(b, 0, sizeof(*b));
+  initsleeplock(&b->lock, "disklat");
+  acquiresleep(&b->lock);
+  b->dev = ROOTDEV;
+  for(int i = 0; i < n; i++){
+    b->blockno = (i * 7919) % FSSIZE;   // 跳着读，避开设备端的顺序优化
+    t0 = r_time();
+    virtio_disk_rw(b, 0);
+    tot += r_time() - t0;
   }
+  releasesleep(&b->lock);
+  kfree(b);
+  return tot / 10;
+}
 
-  release(&disk.vdisk_lock);
+// for statistics: "--- disk: ..." counters.
+int
+virtio_disk_stats(char *buf, int sz)
+{
+  return snprintf(buf, sz, "--- disk: event-idx %d kick %d no-kick %d intr %d polled %d\n",
+                  disk.event_idx, (int)disk.nkick, (int)disk.nnokick,
+                  (int)disk.nintr, (int)disk.npolled);
 }
@@ -57,6 +57,9 @@ kvmmake(void)
   kvmmap(kpgtbl, 0x40000000L, 0x40000000L, 0x20000, PTE_R | PTE_W);
 // END LAB_NET
 
+  // ACLINT SSWI, for inter-processor interrupts
+  kvmmap(kpgtbl, ACLINT_SSWI, ACLINT_SSWI, PGSIZE, PTE_R | PTE_W);
+
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x4000000, PTE_R | PTE_W);
 
@@ -70,9 +73,9 @@ kvmmake(void)
   // the highest virtual address in the kernel.
   kvmmap(kpgtbl, TRAMPOLINE, (uint64)trampoline, PGSIZE, PTE_R | PTE_X);
 
-  // allocate and map a kernel stack for each process.
-  proc_mapstacks(kpgtbl);
-  
+  // kernel stacks are mapped as processes are allocated,
+  // see proc_mapkstack().
+
   return kpgtbl;
 }
 
@@ -262,6 +265,8 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
   uint64 a;
   pte_t *pte;
+  uint64 pa[32];
+  int n = 0;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
@@ -271,12 +276,20 @@ uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
       continue;   
     if((*pte & PTE_V) == 0)  // has physical page been allocated?
       continue;
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
-    }
+    if(do_free)
+      pa[n++] = PTE2PA(*pte);
     *pte = 0;
+    if(n == NELEM(pa)){
+      // another thread's hart may still cache these translations;
+      // it must drop them before the pages can be reused.
+      tlb_shootdown(pagetable);
+      while(n > 0)
+        kfree((void*)pa[--n]);
+    }
   }
+  tlb_shootdown(pagetable);
+  while(n > 0)
+    kfree((void*)pa[--n]);
 }
 
 // Allocate PTEs and physical memory to grow a process from oldsz to
@@ -345,6 +358,32 @@ freewalk(pagetable_t pagetable)
   kfree((void*)pagetable);
 }
 
+// Free the page-table pages of a process page table except the
+// path down to the trampoline, leaving a skeleton whose only
+// mapping is TRAMPOLINE. Everything else must already be unmapped.
+void
+uvmstrip(pagetable_t pagetable)
+{
+  pagetable_t pt = pagetable;
+
+  for(int level = 2; level > 0; level--){
+    for(int i = 0; i < 512; i++){
+      pte_t pte = pt[i];
+      if(i == PX(level, TRAMPOLINE) || (pte & PTE_V) == 0)
+        continue;
+      if(pte & (PTE_R|PTE_W|PTE_X))
+        panic("uvmstrip: leaf");
+      freewalk((pagetable_t)PTE2PA(pte));
+      pt[i] = 0;
+    }
+    pt = (pagetable_t)PTE2PA(pt[PX(level, TRAMPOLINE)]);
+  }
+  for(int i = 0; i < 512; i++){
+    if(i != PX(0, TRAMPOLINE) && (pt[i] & PTE_V))
+      panic("uvmstrip: leaf");
+  }
+}
+
 // Free user memory pages,
 // then free page-table pages.
 void
@@ -394,9 +433,12 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
       goto err;
     }
   }
+  // 父进程的页已变为只读，其他线程所在 hart 上的 TLB 也要失效
+  tlb_shootdown(old);
   return 0;
 
  err:
+  tlb_shootdown(old);
   uvmunmap(new, 0, i / PGSIZE, 1);
   return -1;
 }
@@ -432,17 +474,17 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     // 注意：在exec过程中，pagetable可能不是当前进程的pagetable，
     // 所以需要特殊处理这种情况
     struct proc *curproc = myproc();
-    if(curproc && curproc->pagetable == pagetable && va0 >= curproc->sz)
+    if(curproc && curproc->pagetable == pagetable && va0 >= curproc->mm->sz)
       return -1;
   
     pte = walk(pagetable, va0, 0);
     if(pte == 0 || (*pte & PTE_V) == 0) {
-      if((pa0 = vmfault(pagetable, va0, 0)) == 0) {
+      if(vmfault(pagetable, va0, 0) == 0) {
         return -1;
       }
-    } else {
-      pa0 = PTE2PA(*pte);
+      pte = walk(pagetable, va0, 0);
     }
+    pa0 = PTE2PA(*pte);
     // 检查是否是 COW 页面
     if((*pte & PTE_COW) && (*pte & PTE_W) == 0) {
       // 处理 COW 页面
@@ -458,7 +500,7 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
       // 注意：在exec过程中，pagetable可能不是当前进程的pagetable，
       // 所以需要特殊处理这种情况
       struct proc *curproc = myproc();
-      if(curproc && curproc->pagetable == pagetable && va0 >= curproc->sz)
+      if(curproc && curproc->pagetable == pagetable && va0 >= curproc->mm->sz)
         return -1;
 
       // 更新 pa0，因为 cow_handler 可能已经修改了页表项
@@ -551,29 +593,24 @@ copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
   }
 }
 
-// 处理 COW 页错误
-int
-cow_handler(pagetable_t pagetable, uint64 va)
+// The lock that serializes changes to pagetable: the mm's lock
+// if it is the current process's page table, which its threads
+// share and may fault on at the same time; none for a page table
+// exec() is still building.
+static struct spinlock*
+pglock(pagetable_t pagetable)
 {
-  if(va >= MAXVA)
-    return -1;
+  struct proc *p = myproc();
 
-  va = PGROUNDDOWN(va); // 向下取整
-  
-  pte_t *pte = walk(pagetable, va, 0);
-  if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_COW) == 0)
-    return -1;
-  
-  uint64 pa = PTE2PA(*pte);
-  uint flags = PTE_FLAGS(*pte);
-  
-  // 如果引用计数为 1，则直接写
-  if(get_refcnt((void*)pa) == 1) {
-    flags = (flags & ~PTE_COW) | PTE_W;   // 更新页表项，设置为可写并清除 COW 标记
-    *pte = PA2PTE(pa) | flags;            // 更新页表项，映射到新页面并设置为可写
-    return 0;
-  }
-  // 否则，分配新页面
+  if(p && p->mm && p->pagetable == pagetable)
+    return &p->mm->lock;
+  return 0;
+}
+
+// COW 缺页时为副本分配一页。不持有锁，可能 yield()。
+static uint64
+cow_alloc(void)
+{
   uint64 new_pa = (uint64)kalloc();
   if(new_pa == 0) {
     // 尝试从其他CPU窃取内存
@@ -608,55 +645,128 @@ cow_handler(pagetable_t pagetable, uint64 va)
         printf("cow_handler: out of memory, killing process %d", p->pid);
         setkilled(p);
       }
-      return -1;
     }
   }
-  
-  // 复制页面内容
+  return new_pa;
+}
+
+// 处理 COW 页错误。同一进程的其他线程可能同时在处理同一页，
+// 所以在 mm->lock 下重新检查 PTE 后再复制或修改。
+int
+cow_handler(pagetable_t pagetable, uint64 va)
+{
+  struct spinlock *lk = pglock(pagetable);
+  uint64 pa, new_pa = 0;
+  uint flags;
+  pte_t *pte;
+  int ok;
+
+  if(va >= MAXVA)
+    return -1;
+
+  va = PGROUNDDOWN(va); // 向下取整
+
+  for(;;){
+    if(lk)
+      acquire(lk);
+    pte = walk(pagetable, va, 0);
+    if(pte == 0 || (*pte & PTE_V) == 0 || (*pte & PTE_COW) == 0){
+      // 另一个线程已经处理过了（或者页面已被 growproc 释放）。
+      // 本 hart 可能还缓存着只读的旧表项。
+      ok = pte && (*pte & PTE_V) && (*pte & PTE_W);
+      if(lk)
+        release(lk);
+      if(new_pa)
+        kfree((void*)new_pa);
+      if(ok)
+        sfence_vma();
+      return ok ? 0 : -1;
+    }
+
+    pa = PTE2PA(*pte);
+    flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;  // 设置为可写并清除 COW 标记
+
+    // 如果引用计数为 1，则直接写
+    if(get_refcnt((void*)pa) == 1) {
+      *pte = PA2PTE(pa) | flags;
+      if(lk)
+        release(lk);
+      if(new_pa)
+        kfree((void*)new_pa);
+      sfence_vma();
+      return 0;
+    }
+    if(new_pa)
+      break;
+
+    // 否则，分配新页面。分配可能 yield()，不能持锁，
+    // 分配后回到上面重新检查。
+    if(lk)
+      release(lk);
+    if((new_pa = cow_alloc()) == 0)
+      return -1;
+  }
+
+  // 复制页面内容，映射到新页面
   memmove((void*)new_pa, (void*)pa, PGSIZE);
-  
-  // 减少原页面的引用计数
-  dec_refcnt((void*)pa);
-  
-  // 更新页表项，设置为可写并清除 COW 标记
-  flags = (flags & ~PTE_COW) | PTE_W;
   *pte = PA2PTE(new_pa) | flags;
-  
-  // 刷新 TLB
+
+  // 刷新 TLB（包括运行同一地址空间的其他 hart），之后才能
+  // 减少原页面的引用计数：它可能因此被释放。
   sfence_vma();
-  
+  tlb_shootdown(pagetable);
+  dec_refcnt((void*)pa);
+  if(lk)
+    release(lk);
+
   return 0;
 }
 
 // allocate and map user memory if process is referencing a page
 // that was lazily allocated in sys_sbrk().
-// returns 0 if va is invalid or already mapped, or if
-// out of physical memory, and physical address if successful.
+// returns 0 if va is invalid or out of physical memory, and the
+// physical address if successful. The threads of a process may
+// fault on the same page at once: under mm->lock, a page another
+// thread has just mapped counts as success, if it allows the access.
 uint64
 vmfault(pagetable_t pagetable, uint64 va, int read)
 {
   uint64 mem;
   struct proc *p = myproc();
+  struct spinlock *lk = &p->mm->lock;
+  pte_t *pte;
 
-  // 检查是否超出进程大小限制
-  if (va >= p->sz)
-    return 0;
-    
   // 检查是否是内核地址空间
   if (va >= KERNBASE)
     return 0;
   va = PGROUNDDOWN(va);
-  if(ismapped(pagetable, va)) {
+  acquire(lk);
+  // 检查是否超出进程大小限制；growproc() 持同一把锁修改它
+  if (va >= p->mm->sz) {
+    release(lk);
     return 0;
   }
+  if((pte = walk(p->pagetable, va, 0)) != 0 && (*pte & PTE_V)) {
+    mem = 0;
+    if((*pte & PTE_U) && (read || (*pte & PTE_W)))
+      mem = PTE2PA(*pte);
+    release(lk);
+    if(mem)
+      sfence_vma();
+    return mem;
+  }
   mem = (uint64) kalloc();
-  if(mem == 0)
+  if(mem == 0) {
+    release(lk);
     return 0;
+  }
   memset((void *) mem, 0, PGSIZE);
   if (mappages(p->pagetable, va, PGSIZE, mem, PTE_W|PTE_U|PTE_R) != 0) {
+    release(lk);
     kfree((void *)mem);
     return 0;
   }
+  release(lk);
   return mem;
 }
 
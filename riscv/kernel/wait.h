@@ -0,0 +1,2 @@
+// wait4() 的 options
+#define WNOHANG 1   // 没有已退出的子进程时立即返回 0
@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/BPB + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = MYLOGBLOCKS+1;   // Header followed by LOGBLOCKS data blocks.
+int nlog = NLOGREGION*(MYLOGBLOCKS+1);   // Regions of a header followed by LOGBLOCKS data blocks.
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
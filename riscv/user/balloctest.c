@@ -0,0 +1,126 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+// 块分配测试：statistics 里缓存的空闲块数与文件的增删一致；
+// 把磁盘写满时 write() 返回错误，而不是等到延迟分配刷出时
+// 才丢数据；全部删掉后空闲块数复原。
+
+#define NSMALL 30     // test0 文件的块数，超过 NDIRECT，需要间接块
+#define NFILES 20     // test1 最多的文件数
+
+char buf[BSIZE];
+char sbuf[4096];
+
+void
+fail(char *msg)
+{
+  printf("balloctest: %s: FAIL\n", msg);
+  exit(1);
+}
+
+// statistics 里 "--- balloc:" 一行中 key 后面的数。
+int
+bstat(char *key)
+{
+  char *c;
+  int n = strlen(key);
+
+  statistics(sbuf, sizeof(sbuf));
+  for(c = sbuf; *c; c++)
+    if(memcmp(c, "--- balloc:", 11) == 0)
+      break;
+  for(; *c && *c != '\n'; c++)
+    if(memcmp(c, key, n) == 0 && c[n] == ' ')
+      return atoi(c + n + 1);
+  return -1;
+}
+
+void
+test0(void)
+{
+  int fd, free0, used;
+
+  printf("start test0\n");
+  if((free0 = bstat("free")) < 0)
+    fail("no balloc stats");
+  if((fd = open("bt0", O_CREATE | O_RDWR)) < 0)
+    fail("create");
+  for(int b = 0; b < NSMALL; b++){
+    memset(buf, b, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE)
+      fail("write");
+  }
+  if(fsync(fd) != 0)
+    fail("fsync");
+  close(fd);
+  used = free0 - bstat("free");
+  // 数据块、间接块，目录也可能长一块
+  if(used < NSMALL + 1 || used > NSMALL + 2)
+    fail("free count after write");
+  unlink("bt0");
+  if(free0 - bstat("free") > 1)
+    fail("free count after unlink");
+  printf("test0: %d blocks used, OK\n", used);
+}
+
+void
+test1(void)
+{
+  char name[] = "bt00";
+  int fd, n, free0, total = 0, full = 0;
+  int size[NFILES];
+  struct stat st;
+
+  printf("start test1\n");
+  free0 = bstat("free");
+  for(n = 0; n < NFILES && !full; n++){
+    name[2] = '0' + n / 10;
+    name[3] = '0' + n % 10;
+    if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+      full = 1;
+      break;
+    }
+    memset(buf, n, BSIZE);
+    for(size[n] = 0; size[n] < MAXFILE * BSIZE; size[n] += BSIZE){
+      if(write(fd, buf, BSIZE) != BSIZE){
+        full = 1;
+        break;
+      }
+    }
+    if(fsync(fd) != 0)
+      fail("fsync");
+    if(fstat(fd, &st) < 0 || st.size != size[n])
+      fail("data lost after fsync");
+    total += size[n] / BSIZE;
+    close(fd);
+  }
+  printf("test1: %d blocks in %d files, %d free\n", total, n, bstat("free"));
+  if(!full)
+    fail("disk never filled");
+  if(bstat("free") > NFILES)
+    fail("free blocks left when full");
+  for(int i = 0; i < n; i++){
+    name[2] = '0' + i / 10;
+    name[3] = '0' + i % 10;
+    if((fd = open(name, O_RDONLY)) >= 0){
+      if(size[i] > 0 && (read(fd, buf, BSIZE) != BSIZE || buf[0] != (char)i))
+        fail("content");
+      close(fd);
+    }
+    unlink(name);
+  }
+  if(free0 - bstat("free") > 1)
+    fail("free count after unlink");
+  printf("test1: OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  test0();
+  test1();
+  exit(0);
+}
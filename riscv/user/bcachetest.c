@@ -0,0 +1,237 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+// 缓冲区缓存测试：多个进程同时读写不同的文件，检查内容正确，
+// 并比较前后 statistics 里 kmem/bcache 锁的自旋次数；
+// 再检查缓存能长到 NBUF 以上，以及顺序读时的预读。
+
+#define NCHILD 4
+#define NBLOCK 10     // 每个文件的块数
+#define NROUND 50
+#define NBIG 200      // test2 文件的块数，远大于 NBUF
+
+char buf[BSIZE];
+char sbuf[4096];
+
+int
+ntas(void)
+{
+  char *c;
+
+  if(statistics(sbuf, sizeof(sbuf)) <= 0){
+    fprintf(2, "bcachetest: no stats\n");
+    exit(1);
+  }
+  c = strchr(sbuf, '=');
+  return atoi(c + 2);
+}
+
+void
+createfile(char *name, int seed)
+{
+  int fd;
+
+  if((fd = open(name, O_CREATE | O_RDWR)) < 0){
+    printf("bcachetest: create %s failed\n", name);
+    exit(1);
+  }
+  for(int b = 0; b < NBLOCK; b++){
+    memset(buf, seed + b, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("bcachetest: write %s failed\n", name);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// 反复读 name 并检查每一块的内容。
+int
+readfile(char *name, int seed)
+{
+  int fd;
+
+  if((fd = open(name, O_RDONLY)) < 0)
+    return -1;
+  for(int b = 0; b < NBLOCK; b++){
+    if(read(fd, buf, BSIZE) != BSIZE)
+      return -1;
+    for(int i = 0; i < BSIZE; i++)
+      if(buf[i] != (char)(seed + b))
+        return -1;
+  }
+  close(fd);
+  return 0;
+}
+
+// 各进程读各自的小文件：工作集装得下缓存，几乎全部命中，
+// 考验的是查找路径上的锁竞争。
+void
+test0(void)
+{
+  char name[] = "bc0";
+  int m, n, status, ok = 1;
+
+  printf("start test0\n");
+  for(int i = 0; i < NCHILD; i++){
+    name[2] = '0' + i;
+    createfile(name, i * 16);
+  }
+  m = ntas();
+  for(int i = 0; i < NCHILD; i++){
+    if(fork() == 0){
+      name[2] = '0' + i;
+      for(int r = 0; r < NROUND; r++)
+        if(readfile(name, i * 16) < 0)
+          exit(1);
+      exit(0);
+    }
+  }
+  for(int i = 0; i < NCHILD; i++){
+    wait(&status);
+    if(status != 0)
+      ok = 0;
+  }
+  n = ntas();
+  printf("test0 results:\n%s", sbuf);
+  if(!ok)
+    printf("test0: FAIL wrong content\n");
+  else if(n - m < 500)
+    printf("test0: OK\n");
+  else
+    printf("test0: FAIL #test-and-set %d\n", n - m);
+  for(int i = 0; i < NCHILD; i++){
+    name[2] = '0' + i;
+    unlink(name);
+  }
+}
+
+// 各进程不断创建、读、删除文件，总块数超出缓存，buf 要在
+// 桶之间迁移。只检查内容。
+void
+test1(void)
+{
+  char name[] = "bd0";
+  int status, ok = 1;
+
+  printf("start test1\n");
+  for(int i = 0; i < NCHILD; i++){
+    if(fork() == 0){
+      name[2] = '0' + i;
+      for(int r = 0; r < NROUND / 5; r++){
+        createfile(name, i * 16 + r);
+        if(readfile(name, i * 16 + r) < 0)
+          exit(1);
+        unlink(name);
+      }
+      exit(0);
+    }
+  }
+  for(int i = 0; i < NCHILD; i++){
+    wait(&status);
+    if(status != 0)
+      ok = 0;
+  }
+  printf(ok ? "test1: OK\n" : "test1: FAIL wrong content\n");
+}
+
+// statistics 里以 line 开头的一行中 key 后面的数。
+int
+bstat(char *line, char *key)
+{
+  char *c;
+  int n = strlen(key);
+
+  statistics(sbuf, sizeof(sbuf));
+  for(c = sbuf; *c; c++)
+    if(memcmp(c, line, strlen(line)) == 0)
+      break;
+  for(; *c && *c != '\n'; c++)
+    if(memcmp(c, key, n) == 0 && c[n] == ' ')
+      return atoi(c + n + 1);
+  return -1;
+}
+
+// 连读两遍一个 NBIG 块的文件：缓存应当长到装下它，
+// 第二遍基本都命中。
+void
+test2(void)
+{
+  int fd, nbuf, miss = 0;
+
+  printf("start test2\n");
+  if((fd = open("bcbig", O_CREATE | O_RDWR)) < 0){
+    printf("bcachetest: create bcbig failed\n");
+    exit(1);
+  }
+  for(int b = 0; b < NBIG; b++){
+    memset(buf, b, BSIZE);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("bcachetest: write bcbig failed\n");
+      exit(1);
+    }
+  }
+  fsync(fd);  // allocate the delayed blocks, through the cache
+  close(fd);
+  for(int r = 0; r < 2; r++){
+    if(r == 1)
+      miss = bstat("--- bcache:", "miss");
+    fd = open("bcbig", O_RDONLY);
+    for(int b = 0; b < NBIG; b++){
+      if(read(fd, buf, BSIZE) != BSIZE || buf[0] != (char)b){
+        printf("test2: FAIL wrong content\n");
+        exit(1);
+      }
+    }
+    close(fd);
+  }
+  miss = bstat("--- bcache:", "miss") - miss;
+  nbuf = bstat("--- bcache:", "nbuf");
+  unlink("bcbig");
+  printf("test2: nbuf %d, %d misses on second pass\n", nbuf, miss);
+  if(nbuf <= NBIG || miss > NBIG / 10)
+    printf("test2: FAIL cache did not grow\n");
+  else
+    printf("test2: OK\n");
+}
+
+// 顺序读一个启动以来没读过的大文件（usertests），
+// 预读的块应当大多被用上。
+void
+test3(void)
+{
+  int fd, n, issued, hit;
+
+  printf("start test3\n");
+  issued = bstat("--- readahead:", "issued");
+  hit = bstat("--- readahead:", "hit");
+  if((fd = open("usertests", O_RDONLY)) < 0){
+    printf("test3: no usertests, skipped\n");
+    return;
+  }
+  while((n = read(fd, buf, BSIZE)) > 0)
+    ;
+  close(fd);
+  issued = bstat("--- readahead:", "issued") - issued;
+  hit = bstat("--- readahead:", "hit") - hit;
+  printf("test3: %d blocks read ahead, %d used\n", issued, hit);
+  if(issued == 0)
+    printf("test3: usertests already cached, skipped\n");
+  else if(hit < issued / 2)
+    printf("test3: FAIL readahead not used\n");
+  else
+    printf("test3: OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  test0();
+  test1();
+  test2();
+  test3();
+  exit(0);
+}
@@ -0,0 +1,51 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// 磁盘延迟测试：绕过缓冲区缓存逐块读盘，比较中断完成和
+// 不同轮询时长下每个请求的平均延迟，并打印 statistics 里
+// 磁盘一行的计数（通知、中断、轮询完成的请求数）。
+
+#define N 500
+
+int polls[] = { 0, 20, 100, 1000 };   // 轮询时长（微秒），0 为只用中断
+char sbuf[4096];
+
+// 打印 statistics 中 "--- disk:" 一行。
+void
+diskstats(void)
+{
+  char *c, *e;
+
+  if(statistics(sbuf, sizeof(sbuf)) <= 0)
+    return;
+  for(c = sbuf; *c; c++)
+    if(memcmp(c, "--- disk:", 9) == 0)
+      break;
+  for(e = c; *e && *e != '\n'; e++)
+    ;
+  *e = 0;
+  printf("  %s\n", c);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int old, us;
+
+  old = diskpoll(0);
+  for(int i = 0; i < sizeof(polls) / sizeof(polls[0]); i++){
+    diskpoll(polls[i]);
+    if((us = disklat(N)) < 0){
+      printf("disklat: failed\n");
+      exit(1);
+    }
+    if(polls[i] == 0)
+      printf("interrupt: ");
+    else
+      printf("poll %dus: ", polls[i]);
+    printf("%d reads, avg %d us\n", N, us / N);
+    diskstats();
+  }
+  diskpoll(old);
+  exit(0);
+}
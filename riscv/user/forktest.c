@@ -1,11 +1,15 @@
 // Test that fork fails gracefully.
 // Tiny executable so that the limit can be filling the proc table.
+// Also times fork+exit+wait cycles.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/riscv.h"
 #include "user/user.h"
 
 #define N  1000
+#define NBENCH 500     // fork+exit+wait cycles to time
+#define TIMEBASE 10    // qemu virt 的 time 为 10MHz，每微秒 10 个计数
 
 void
 print(const char *s)
@@ -48,9 +52,53 @@ forktest(void)
   print("fork test OK\n");
 }
 
+// no printf: forktest links only ulib.o and usys.o.
+void
+printnum(uint64 n)
+{
+  char buf[24];
+  int i = sizeof(buf);
+
+  buf[--i] = 0;
+  do {
+    buf[--i] = '0' + n % 10;
+    n /= 10;
+  } while(n > 0);
+  print(buf + i);
+}
+
+void
+forkbench(void)
+{
+  uint64 t0 = 0, t1;
+  int pid;
+
+  for(int i = 0; i < NBENCH; i++){
+    if(i == 1)
+      t0 = r_time();    // the first cycle warms the caches
+    pid = fork();
+    if(pid < 0){
+      print("fork bench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0)
+      exit(0);
+    if(wait(0) != pid){
+      print("fork bench: wait failed\n");
+      exit(1);
+    }
+  }
+  t1 = r_time();
+
+  print("fork+exit+wait: ");
+  printnum((t1 - t0) / TIMEBASE / (NBENCH - 1));
+  print(" us per cycle\n");
+}
+
 int
 main(void)
 {
   forktest();
+  forkbench();
   exit(0);
 }
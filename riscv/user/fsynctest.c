@@ -0,0 +1,157 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+// 组提交测试：几个进程同时创建、写、删除小文件，
+// 比较 statistics 中结束的文件系统操作数和提交次数；
+// 再检查 fsync 之后数据可以读回；再一次写入一个大文件，
+// 文件数据不进日志，只需要很少几个事务；最后多次小追加，
+// 块的分配推迟到 fsync，追加时几乎没有提交。
+
+#define NCHILD 4
+#define NFILE 20
+#define NBIG 200      // 大文件的块数
+#define NAPPEND 100   // 小追加的次数，每次 100 字节
+
+char sbuf[4096];
+char big[NBIG * BSIZE];
+
+// statistics 里以 line 开头的一行中 key 后面的数。
+int
+sstat(char *line, char *key)
+{
+  char *c;
+  int n = strlen(key);
+
+  statistics(sbuf, sizeof(sbuf));
+  for(c = sbuf; *c; c++)
+    if(memcmp(c, line, strlen(line)) == 0)
+      break;
+  for(; *c && *c != '\n'; c++)
+    if(memcmp(c, key, n) == 0 && c[n] == ' ')
+      return atoi(c + n + 1);
+  return -1;
+}
+
+int
+logstat(char *key)
+{
+  return sstat("--- log:", key);
+}
+
+void
+fail(char *msg)
+{
+  printf("fsynctest: %s: FAIL\n", msg);
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char name[] = "fs00";
+  char buf[100];
+  int fd, ops, commits, logged, flushed, status;
+
+  printf("fsynctest: start\n");
+  ops = logstat("ops");
+  commits = logstat("commits");
+  if(ops < 0)
+    fail("no log stats");
+
+  for(int i = 0; i < NCHILD; i++){
+    if(fork() == 0){
+      name[2] = '0' + i;
+      for(int j = 0; j < NFILE; j++){
+        name[3] = 'a' + j;
+        if((fd = open(name, O_CREATE | O_RDWR)) < 0)
+          exit(1);
+        write(fd, name, sizeof(name));
+        close(fd);
+        unlink(name);
+      }
+      exit(0);
+    }
+  }
+  for(int i = 0; i < NCHILD; i++){
+    wait(&status);
+    if(status != 0)
+      fail("child");
+  }
+  ops = logstat("ops") - ops;
+  commits = logstat("commits") - commits;
+  printf("fsynctest: %d file system calls, %d commits\n", ops, commits);
+  if(commits >= ops)
+    fail("no batching");
+
+  if((fd = open("fsyncf", O_CREATE | O_RDWR)) < 0)
+    fail("create");
+  if(write(fd, "durable", 8) != 8)
+    fail("write");
+  if(fsync(fd) != 0)
+    fail("fsync");
+  if(fsync(-1) != -1)
+    fail("fsync bad fd");
+  close(fd);
+  if((fd = open("fsyncf", O_RDONLY)) < 0 || read(fd, buf, 8) != 8 || strcmp(buf, "durable") != 0)
+    fail("read back");
+  close(fd);
+  unlink("fsyncf");
+
+  for(int i = 0; i < sizeof(big); i++)
+    big[i] = i / BSIZE + i;
+  ops = logstat("ops");
+  logged = logstat("logged");
+  if((fd = open("fsyncbig", O_CREATE | O_RDWR)) < 0)
+    fail("create big");
+  if(write(fd, big, sizeof(big)) != sizeof(big))
+    fail("write big");
+  if(fsync(fd) != 0)
+    fail("fsync big");
+  close(fd);
+  ops = logstat("ops") - ops;
+  logged = logstat("logged") - logged;
+  printf("fsynctest: %d blocks written in %d file system calls, %d blocks logged\n",
+         NBIG, ops, logged);
+  if(ops > 12 || logged >= NBIG / 4)
+    fail("file data logged");
+  memset(big, 0, sizeof(big));
+  if((fd = open("fsyncbig", O_RDONLY)) < 0 || read(fd, big, sizeof(big)) != sizeof(big))
+    fail("read big");
+  close(fd);
+  for(int i = 0; i < sizeof(big); i++)
+    if(big[i] != (char)(i / BSIZE + i))
+      fail("big content");
+  unlink("fsyncbig");
+
+  if((fd = open("fsyncapp", O_CREATE | O_RDWR)) < 0 || fsync(fd) != 0)
+    fail("create append");
+  commits = logstat("commits");
+  flushed = sstat("--- delalloc:", "flushed");
+  for(int i = 0; i < NAPPEND; i++){
+    memset(buf, 'a' + i % 26, sizeof(buf));
+    if(write(fd, buf, 100) != 100)
+      fail("append");
+  }
+  commits = logstat("commits") - commits;
+  if(fsync(fd) != 0)
+    fail("fsync append");
+  close(fd);
+  flushed = sstat("--- delalloc:", "flushed") - flushed;
+  printf("fsynctest: %d appends, %d commits, %d blocks flushed\n",
+         NAPPEND, commits, flushed);
+  if(commits >= NAPPEND / 10)
+    fail("appends not delayed");
+  if((fd = open("fsyncapp", O_RDONLY)) < 0)
+    fail("open append");
+  for(int i = 0; i < NAPPEND; i++){
+    if(read(fd, buf, 100) != 100 || buf[0] != 'a' + i % 26 || buf[99] != 'a' + i % 26)
+      fail("append content");
+  }
+  close(fd);
+  unlink("fsyncapp");
+  printf("fsynctest: OK\n");
+
+  exit(0);
+}
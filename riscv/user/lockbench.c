@@ -0,0 +1,83 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// 内核自旋锁吞吐量测试：1 到 8 个 hart 同时争抢同一把内核锁，
+// 输出每毫秒的总获取次数，以及各 hart 获取次数的最小值和最大值
+// （二者相差越大越不公平）。用 SPINLOCK=tas/ticket/mcs 分别编译内核对比。
+
+#define MAXHART 8
+#define MS 200
+
+// 在子进程里逐个尝试 cpupin，数出已启动的 hart 个数。
+int
+count_harts(void)
+{
+  int pid, n, status;
+
+  if((pid = fork()) < 0){
+    printf("lockbench: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    for(n = 0; n < MAXHART; n++)
+      if(cpupin(n) < 0)
+        break;
+    exit(n);
+  }
+  wait(&status);
+  return status;
+}
+
+void
+run(int nharts)
+{
+  int fds[2], pid;
+  uint64 cnt, tot = 0, min = ~0UL, max = 0;
+
+  if(pipe(fds) < 0){
+    printf("lockbench: pipe failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < nharts; i++){
+    if((pid = fork()) < 0){
+      printf("lockbench: fork failed\n");
+      exit(1);
+    }
+    if(pid == 0){
+      close(fds[0]);
+      if(cpupin(i) < 0 || (cnt = lockbench(nharts, MS)) == (uint64)-1)
+        cnt = 0;
+      write(fds[1], &cnt, sizeof(cnt));
+      exit(0);
+    }
+  }
+  close(fds[1]);
+  for(int i = 0; i < nharts; i++){
+    if(read(fds[0], &cnt, sizeof(cnt)) != sizeof(cnt)){
+      printf("lockbench: short read\n");
+      exit(1);
+    }
+    tot += cnt;
+    if(cnt < min)
+      min = cnt;
+    if(cnt > max)
+      max = cnt;
+  }
+  close(fds[0]);
+  for(int i = 0; i < nharts; i++)
+    wait(0);
+
+  printf("harts %d: %d acquires/ms, per hart min %d max %d\n",
+         nharts, (int)(tot / MS), (int)min, (int)max);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int nharts = count_harts();
+
+  printf("lockbench: %d harts, %d ms per run\n", nharts, MS);
+  for(int n = 1; n <= nharts; n++)
+    run(n);
+  exit(0);
+}
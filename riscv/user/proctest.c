@@ -0,0 +1,69 @@
+#include "kernel/types.h"
+#include "user/user.h"
+
+// 动态进程表测试：同时存活的进程数超过原来的 NPROC（64），
+// 按 pid 查找的 kill/waitpid/getppid 仍然正确。
+
+#define NMANY 200
+
+void
+fail(char *msg)
+{
+  printf("proctest: %s: FAIL\n", msg);
+  exit(1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int pids[NMANY], fds[2], ppid, status, n;
+  char c;
+
+  printf("proctest: start\n");
+  if(pipe(fds) < 0)
+    fail("pipe");
+  ppid = getpid();
+
+  for(n = 0; n < NMANY; n++){
+    if((pids[n] = fork()) < 0)
+      break;
+    if(pids[n] == 0){
+      close(fds[1]);
+      if(getppid() != ppid)
+        exit(2);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[0]);
+  printf("proctest: %d processes alive\n", n + 1);
+  if(n <= 64)
+    fail("process table still limited");
+
+  // 杀掉每隔 10 个的子进程，再按 pid 等待它们
+  for(int i = 0; i < n; i += 10)
+    if(kill(pids[i]) < 0)
+      fail("kill");
+  for(int i = 0; i < n; i += 10){
+    if(waitpid(pids[i], &status, 0) != pids[i])
+      fail("waitpid killed child");
+  }
+  if(kill(pids[0]) != -1)
+    fail("kill reaped pid");
+
+  // 其余子进程在管道关闭后退出
+  close(fds[1]);
+  for(int i = 0; i < n; i++){
+    if(i % 10 == 0)
+      continue;
+    if(waitpid(pids[i], &status, 0) != pids[i] || status != 0)
+      fail("getppid or exit status");
+  }
+  if(wait(0) != -1)
+    fail("leftover children");
+
+  if(getppid() <= 0)
+    fail("getppid");
+  printf("proctest: OK\n");
+  exit(0);
+}
@@ -0,0 +1,126 @@
+#include "kernel/types.h"
+#include "kernel/riscv.h"
+#include "kernel/times.h"
+#include "user/user.h"
+
+// 唤醒延迟测试：唤醒者把 r_time() 写入管道，睡在 read() 上的
+// 进程醒来后读出时间戳并计算延迟。睡眠者所在的 CPU 上始终有
+// 一个忙循环进程，唤醒者写完后也继续忙循环，所以普通进程只能
+// 等到下一个时钟滴答（约 100ms）才能运行；SCHED_FIFO 进程应当
+// 立即抢占。
+//
+// local：唤醒者和睡眠者都在 CPU 0，经 need_resched 在本 hart 抢占；
+// remote：唤醒者在 CPU 0，睡眠者在 CPU 1，经 IPI 抢占。
+
+#define ROUNDS 10
+#define SPIN 1500000       // 每轮唤醒后唤醒者忙循环的时长（time 计数，约 150ms）
+#define TIMEBASE 10        // qemu virt 的 time 为 10MHz，即每微秒 10 个计数
+#define RTLIMIT 25000      // 实时进程最坏延迟上限（微秒），远小于一个时钟滴答
+
+struct result {
+  uint64 sum;
+  uint64 max;
+};
+
+static void
+sleeper(int cpu, int policy, int rfd, int wfd)
+{
+  struct result r = { 0, 0 };
+  uint64 ts, lat;
+
+  if(cpupin(cpu) < 0 || sched_setscheduler(0, policy, policy == SCHED_FIFO ? 10 : 0) < 0){
+    printf("rttest: setup failed\n");
+    exit(1);
+  }
+  for(int i = 0; i < ROUNDS; i++){
+    if(read(rfd, &ts, sizeof(ts)) != sizeof(ts))
+      exit(1);
+    lat = r_time() - ts;
+    r.sum += lat;
+    if(lat > r.max)
+      r.max = lat;
+  }
+  write(wfd, &r, sizeof(r));
+  exit(0);
+}
+
+// 运行一组测试，返回平均和最大延迟（微秒）。
+static void
+run(char *name, int wcpu, int scpu, int policy, uint64 *avg, uint64 *max)
+{
+  int data[2], res[2];
+  int hog, pid;
+  struct result r;
+
+  if(pipe(data) < 0 || pipe(res) < 0){
+    printf("rttest: pipe failed\n");
+    exit(1);
+  }
+
+  hog = fork();
+  if(hog == 0){
+    cpupin(scpu);
+    for(;;)
+      ;
+  }
+  pid = fork();
+  if(pid == 0){
+    close(data[1]);
+    close(res[0]);
+    sleeper(scpu, policy, data[0], res[1]);
+  }
+  if(hog < 0 || pid < 0){
+    printf("rttest: fork failed\n");
+    exit(1);
+  }
+  close(data[0]);
+  close(res[1]);
+
+  cpupin(wcpu);
+  sleep(2);
+  for(int i = 0; i < ROUNDS; i++){
+    uint64 ts = r_time();
+    write(data[1], &ts, sizeof(ts));
+    while(r_time() - ts < SPIN)
+      ;
+  }
+  if(read(res[0], &r, sizeof(r)) != sizeof(r)){
+    printf("rttest: %s: no result\n", name);
+    exit(1);
+  }
+  close(data[1]);
+  close(res[0]);
+  kill(hog);
+  wait(0);
+  wait(0);
+
+  *avg = r.sum / ROUNDS / TIMEBASE;
+  *max = r.max / TIMEBASE;
+  printf("rttest: %s %s: avg %lu us, max %lu us\n", name,
+         policy == SCHED_FIFO ? "SCHED_FIFO " : "SCHED_OTHER", *avg, *max);
+}
+
+static int
+compare(char *name, int wcpu, int scpu)
+{
+  uint64 oavg, omax, ravg, rmax;
+
+  run(name, wcpu, scpu, SCHED_OTHER, &oavg, &omax);
+  run(name, wcpu, scpu, SCHED_FIFO, &ravg, &rmax);
+  if(rmax > RTLIMIT || ravg > oavg){
+    printf("rttest: %s: FAIL\n", name);
+    return 1;
+  }
+  printf("rttest: %s: OK\n", name);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fail = 0;
+
+  fail |= compare("local ", 0, 0);
+  fail |= compare("remote", 0, 1);
+  exit(fail);
+}
@@ -0,0 +1,176 @@
+#include "kernel/types.h"
+#include "kernel/times.h"
+#include "user/user.h"
+
+// 公平调度测试：把若干个忙循环子进程绑定到同一个 CPU 上，
+// 运行固定的时钟滴答数，比较它们各自得到的 CPU 时间。
+
+#define DURATION 50   // 每轮测试的时长（时钟滴答）
+#define MAXCHILD 4
+
+// 子进程：绑定到 CPU 0，设置 nice，忙循环到截止时间，
+// 把自己的用户态+内核态时间写入管道。
+static void
+spinner(int nice_val, int deadline, int fd)
+{
+  struct tms t;
+  volatile int x = 0;
+
+  if(cpupin(0) < 0 || setpriority(PRIO_PROCESS, 0, nice_val) < 0){
+    printf("schedtest: setup failed\n");
+    exit(1);
+  }
+  while(uptime() < deadline){
+    for(int i = 0; i < 10000; i++)
+      x++;
+  }
+  times(&t);
+  int used = t.tms_utime + t.tms_stime;
+  write(fd, &used, sizeof(used));
+  exit(0);
+}
+
+// 以给定的 nice 值同时运行 n 个子进程，used[i] 返回各自的 CPU 时间。
+static int
+run(int n, int *nices, int *used)
+{
+  int fds[MAXCHILD][2];
+  int deadline = uptime() + DURATION;
+
+  for(int i = 0; i < n; i++){
+    if(pipe(fds[i]) < 0){
+      printf("schedtest: pipe failed\n");
+      return -1;
+    }
+    int pid = fork();
+    if(pid < 0){
+      printf("schedtest: fork failed\n");
+      return -1;
+    }
+    if(pid == 0){
+      close(fds[i][0]);
+      spinner(nices[i], deadline, fds[i][1]);
+    }
+    close(fds[i][1]);
+  }
+  for(int i = 0; i < n; i++){
+    int st;
+    wait(&st);
+  }
+  for(int i = 0; i < n; i++){
+    if(read(fds[i][0], &used[i], sizeof(used[i])) != sizeof(used[i]))
+      used[i] = 0;
+    close(fds[i][0]);
+  }
+  return 0;
+}
+
+static int
+report(char *name, int n, int *nices, int *used)
+{
+  int total = 0;
+
+  for(int i = 0; i < n; i++)
+    total += used[i];
+  printf("%s:", name);
+  for(int i = 0; i < n; i++)
+    printf(" nice %d -> %d ticks (%d%%)", nices[i], used[i],
+           total ? used[i] * 100 / total : 0);
+  printf("\n");
+  return total;
+}
+
+// 同样 nice 的进程应平分 CPU。
+void
+test_equal(void)
+{
+  int nices[2] = { 0, 0 };
+  int used[2];
+
+  if(run(2, nices, used) < 0)
+    exit(1);
+  int total = report("equal", 2, nices, used);
+  int diff = used[0] > used[1] ? used[0] - used[1] : used[1] - used[0];
+  if(total == 0 || diff * 4 > total){
+    printf("equal: FAIL\n");
+    exit(1);
+  }
+  printf("equal: OK\n");
+}
+
+// nice 相差 5 级的权重比约为 3:1（1024 : 335）。
+void
+test_weighted(void)
+{
+  int nices[2] = { 0, 5 };
+  int used[2];
+
+  if(run(2, nices, used) < 0)
+    exit(1);
+  report("weighted", 2, nices, used);
+  if(used[0] < 2 * used[1]){
+    printf("weighted: FAIL\n");
+    exit(1);
+  }
+  printf("weighted: OK\n");
+}
+
+// 一个交互式进程（反复睡眠一个滴答）与两个 nice 10 的批处理
+// 进程共用 CPU 时，每次醒来都应在很短时间内被调度。
+void
+test_interactive(void)
+{
+  int nices[2] = { 10, 10 };
+  int used[2];
+  int fd[2], pid, late;
+
+  if(pipe(fd) < 0){
+    printf("schedtest: pipe failed\n");
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("schedtest: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    late = 0;
+    close(fd[0]);
+    cpupin(0);
+    sleep(2);
+    for(int i = 0; i < 20; i++){
+      int t0 = uptime();
+      sleep(1);
+      if(uptime() - t0 > 2)
+        late++;
+    }
+    write(fd[1], &late, sizeof(late));
+    exit(0);
+  }
+  close(fd[1]);
+  // run() 的 wait 可能先回收到交互式子进程，结果都经由管道传回，
+  // 这里再补一次 wait 即可。
+  if(run(2, nices, used) < 0)
+    exit(1);
+  wait(0);
+  if(read(fd[0], &late, sizeof(late)) != sizeof(late))
+    late = 20;
+  close(fd[0]);
+  report("interactive", 2, nices, used);
+  if(late > 2){
+    printf("interactive: FAIL (%d of 20 wakeups late)\n", late);
+    exit(1);
+  }
+  printf("interactive: OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("schedtest: start\n");
+  test_equal();
+  test_weighted();
+  test_interactive();
+  printf("schedtest: OK\n");
+  exit(0);
+}
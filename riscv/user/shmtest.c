@@ -2,6 +2,8 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/futex.h"
 
 // 字符串连接函数
 void strcat(char *dest, const char *src) {
@@ -464,6 +466,122 @@ void test_edge_cases() {
   }
 }
 
+// 竞争测试：多个进程在共享内存里用同一把锁累加计数器，
+// 比较纯自旋锁和 futex 互斥锁的耗时。
+#define NBENCH 4         // 竞争的进程数，多于 CPU 数
+#define NBENCHITER 5000  // 每个进程加锁的次数
+
+struct bench {
+  volatile int start;    // futex：父进程置 1 后所有子进程开始
+  volatile int spin;     // 纯自旋锁
+  struct mutex m;        // futex 互斥锁
+  struct mutex donelock;
+  struct cond donecond;  // 子进程全部结束时通知父进程
+  int done;
+  volatile int counter;
+};
+
+static void
+bench_child(int shmid, int usefutex)
+{
+  struct bench *b = (struct bench*)shmat(shmid, 0, 0);
+  if (b == (struct bench*)-1) {
+    printf("子进程附加共享内存失败\n");
+    exit(1);
+  }
+
+  // 等父进程发令：futex 按物理地址匹配，跨进程也能唤醒
+  while (b->start == 0)
+    futex(&b->start, FUTEX_WAIT, 0);
+
+  for (int i = 0; i < NBENCHITER; i++) {
+    if (usefutex) {
+      mutex_lock(&b->m);
+      b->counter++;
+      mutex_unlock(&b->m);
+    } else {
+      while (__sync_lock_test_and_set(&b->spin, 1) != 0)
+        ;
+      __sync_synchronize();
+      b->counter++;
+      __sync_synchronize();
+      __sync_lock_release(&b->spin);
+    }
+  }
+
+  mutex_lock(&b->donelock);
+  b->done++;
+  cond_signal(&b->donecond);
+  mutex_unlock(&b->donelock);
+
+  shmdt(b);
+  exit(0);
+}
+
+// 返回耗时（time 计数）
+static uint64
+bench_run(int usefutex)
+{
+  int shmid = shmget(SHM_KEY + 7 + usefutex, SHM_SIZE, 0x01000);
+  if (shmid < 0) {
+    printf("创建共享内存失败\n");
+    exit(1);
+  }
+
+  // 子进程各自 shmat：fork 会把已附加的段按写时复制处理
+  for (int i = 0; i < NBENCH; i++) {
+    int pid = fork();
+    if (pid < 0) {
+      printf("创建子进程失败\n");
+      exit(1);
+    }
+    if (pid == 0)
+      bench_child(shmid, usefutex);
+  }
+
+  struct bench *b = (struct bench*)shmat(shmid, 0, 0);
+  if (b == (struct bench*)-1) {
+    printf("附加共享内存失败\n");
+    exit(1);
+  }
+  mutex_init(&b->m);
+  mutex_init(&b->donelock);
+  cond_init(&b->donecond);
+  sleep(1);  // 让子进程都睡到 start 上
+
+  uint64 t0 = r_time();
+  b->start = 1;
+  futex(&b->start, FUTEX_WAKE, NBENCH);
+
+  mutex_lock(&b->donelock);
+  while (b->done < NBENCH)
+    cond_wait(&b->donecond, &b->donelock);
+  mutex_unlock(&b->donelock);
+  uint64 t1 = r_time();
+
+  for (int i = 0; i < NBENCH; i++)
+    wait(0);
+
+  int counter = b->counter;
+  shmdt(b);
+  shmctl(shmid, 1, 0);
+  if (counter != NBENCH * NBENCHITER) {
+    printf("计数错误: 期望 %d, 实际 %d\n", NBENCH * NBENCHITER, counter);
+    exit(1);
+  }
+  return t1 - t0;
+}
+
+void test_contention() {
+  printf("\n=== 测试锁竞争（%d 个进程，各 %d 次） ===\n", NBENCH, NBENCHITER);
+
+  // qemu virt 的 time 为 10MHz，每毫秒 10000 个计数
+  uint64 spin = bench_run(0);
+  printf("自旋锁:     %lu ms\n", spin / 10000);
+  uint64 fut = bench_run(1);
+  printf("futex 互斥锁: %lu ms\n", fut / 10000);
+}
+
 int main() {
   printf("共享内存测试程序\n");
 
@@ -473,6 +591,7 @@ int main() {
   test_concurrent_access();
   test_large_data();
   test_edge_cases();
+  test_contention();
 
   printf("\n所有测试通过！\n");
   exit(0);
@@ -9,6 +9,7 @@
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/riscv.h"
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
@@ -16,9 +17,10 @@
 int
 main(int argc, char *argv[])
 {
-  int fd, i;
+  int fd, i, me;
   char path[] = "stressfs0";
   char data[512];
+  uint64 t0 = r_time();
 
   printf("stressfs starting\n");
   memset(data, 'a', sizeof(data));
@@ -27,6 +29,7 @@ main(int argc, char *argv[])
     if(fork() > 0)
       break;
 
+  me = i;
   printf("write %d\n", i);
 
   path[8] += i;
@@ -45,5 +48,9 @@ main(int argc, char *argv[])
 
   wait(0);
 
+  // 最早的进程最后结束，它等到的是整条链，耗时反映文件系统锁的开销。
+  if(me == 0)
+    printf("stressfs: %d us\n", (int)((r_time() - t0) / 10));
+
   exit(0);
 }
@@ -0,0 +1,229 @@
+#include "kernel/types.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// clone() 线程测试
+
+#define NTHREAD 4
+#define NINC 10000
+#define NFPAGE 16   // test_fault 的页数
+
+struct mutex lock;
+volatile int counter;
+volatile int stop;
+volatile char *shared;
+volatile int pipefd[2];
+volatile int go;
+volatile char *fpages;
+
+void
+fail(char *msg)
+{
+  printf("threadtest: %s: FAIL\n", msg);
+  exit(1);
+}
+
+void
+incr(void *arg)
+{
+  for(int i = 0; i < NINC; i++){
+    mutex_lock(&lock);
+    counter++;
+    mutex_unlock(&lock);
+  }
+}
+
+// 多个线程在同一地址空间里用互斥锁累加计数器。
+void
+test_counter(void)
+{
+  int tids[NTHREAD];
+
+  mutex_init(&lock);
+  counter = 0;
+  for(int i = 0; i < NTHREAD; i++){
+    if((tids[i] = thread_create(incr, 0)) < 0)
+      fail("thread_create");
+  }
+  for(int i = 0; i < NTHREAD; i++){
+    if(thread_join(tids[i], 0) != tids[i])
+      fail("thread_join");
+  }
+  if(counter != NTHREAD * NINC)
+    fail("counter");
+  printf("counter: OK\n");
+}
+
+void
+grow(void *arg)
+{
+  char *p = sbrk(4096);
+  if(p == (char *)-1)
+    thread_exit(1);
+  p[0] = 'x';
+  shared = p;
+  thread_exit(7);
+}
+
+// 线程 sbrk 得到的内存对其他线程可见；join 取回退出状态。
+void
+test_memory(void)
+{
+  int tid, status;
+
+  shared = 0;
+  if((tid = thread_create(grow, 0)) < 0)
+    fail("thread_create");
+  if(thread_join(tid, &status) != tid || status != 7)
+    fail("join status");
+  if(shared == 0 || shared[0] != 'x')
+    fail("shared memory");
+  printf("memory: OK\n");
+}
+
+void
+mkpipe(void *arg)
+{
+  int fd[2];
+
+  if(pipe(fd) < 0)
+    thread_exit(1);
+  pipefd[0] = fd[0];
+  pipefd[1] = fd[1];
+  thread_exit(0);
+}
+
+// 线程打开的文件描述符在其他线程中可用。
+void
+test_files(void)
+{
+  int tid, status;
+  char c;
+
+  if((tid = thread_create(mkpipe, 0)) < 0)
+    fail("thread_create");
+  if(thread_join(tid, &status) != tid || status != 0)
+    fail("pipe in thread");
+  if(write(pipefd[1], "y", 1) != 1 || read(pipefd[0], &c, 1) != 1 || c != 'y')
+    fail("shared fds");
+  close(pipefd[0]);
+  close(pipefd[1]);
+  printf("files: OK\n");
+}
+
+void
+spin(void *arg)
+{
+  while(!stop)
+    ;
+}
+
+// 有其他线程时 exec 失败；第一个线程退出会结束整个进程。
+void
+test_exit(void)
+{
+  int pid, tid, status;
+  char *argv[] = { "echo", "exec should have failed", 0 };
+
+  stop = 0;
+  if((tid = thread_create(spin, 0)) < 0)
+    fail("thread_create");
+  if(exec("echo", argv) >= 0)
+    fail("exec with threads");
+  stop = 1;
+  thread_join(tid, 0);
+
+  pid = fork();
+  if(pid < 0)
+    fail("fork");
+  if(pid == 0){
+    stop = 0;
+    for(int i = 0; i < NTHREAD; i++)
+      thread_create(spin, 0);
+    exit(5);
+  }
+  if(wait(&status) != pid || status != 5)
+    fail("exit with threads");
+  printf("exit: OK\n");
+}
+
+void
+touch(void *arg)
+{
+  int k = (int)(uint64)arg;
+
+  while(!go)
+    ;
+  for(int i = 0; i < NFPAGE; i++)
+    fpages[i * 4096 + k] = 'a' + k;
+}
+
+// NTHREAD 个线程同时写 fpages 的每一页，各写自己的字节。
+void
+touchall(void)
+{
+  int tids[NTHREAD];
+
+  go = 0;
+  for(int k = 0; k < NTHREAD; k++){
+    if((tids[k] = thread_create(touch, (void *)(uint64)k)) < 0)
+      fail("thread_create");
+  }
+  go = 1;
+  for(int k = 0; k < NTHREAD; k++)
+    thread_join(tids[k], 0);
+  for(int i = 0; i < NFPAGE; i++)
+    for(int k = 0; k < NTHREAD; k++)
+      if(fpages[i * 4096 + k] != 'a' + k)
+        fail("concurrent fault lost a write");
+}
+
+// 几个线程同时对同一页触发缺页：懒分配的新页，以及 fork 之后
+// 的 COW 页。COW 页不能被多释放一次，子进程的副本要保持不变。
+void
+test_fault(void)
+{
+  int fds[2], pid, status;
+  char c;
+
+  if((fpages = sbrklazy(NFPAGE * 4096)) == SBRK_ERROR)
+    fail("sbrklazy");
+  touchall();
+  printf("lazy fault: OK\n");
+
+  if((fpages = sbrk(NFPAGE * 4096)) == SBRK_ERROR)
+    fail("sbrk");
+  memset((char *)fpages, 'z', NFPAGE * 4096);
+  if(pipe(fds) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(fds[1]);
+    read(fds[0], &c, 1);
+    for(int i = 0; i < NFPAGE * 4096; i++)
+      if(fpages[i] != 'z')
+        exit(1);
+    exit(0);
+  }
+  close(fds[0]);
+  touchall();
+  write(fds[1], "x", 1);
+  close(fds[1]);
+  if(wait(&status) != pid || status != 0)
+    fail("child's copy changed");
+  printf("cow fault: OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("threadtest: start\n");
+  test_counter();
+  test_memory();
+  test_files();
+  test_fault();
+  test_exit();
+  printf("threadtest: OK\n");
+  exit(0);
+}
@@ -3,6 +3,7 @@
 #include "kernel/fcntl.h"
 #include "kernel/riscv.h"
 #include "kernel/vm.h"
+#include "kernel/futex.h"
 #include "user/user.h"
 
 //
@@ -159,3 +160,189 @@ sbrklazy(int n) {
   return sys_sbrk(n, SBRK_LAZY);
 }
 
+
+// 在当前 nice 值上加 inc，返回新的 nice 值，失败返回 -1。
+int
+nice(int inc)
+{
+  int prio = getpriority(0, 0);
+
+  if(prio < 0)
+    return -1;
+  if(setpriority(0, 0, 20 - prio + inc) < 0)
+    return -1;
+  return 20 - getpriority(0, 0);
+}
+
+// 等待子进程 pid（pid <= 0 表示任意子进程）。options 可为 WNOHANG。
+int
+waitpid(int pid, int *status, int options)
+{
+  return wait4(pid, status, options, 0);
+}
+
+//
+// 线程库：clone() 之上的 pthread 风格接口。
+// 线程栈用 sbrk 分配，线程被 join 后留给下一个线程复用。
+// 不用 malloc：umalloc 不是线程安全的，而且 forktest 只链接
+// ulib.o 和 usys.o。
+//
+
+#define TSTACK (2*4096)   // 每个线程的用户栈大小
+#define NUTHREAD 64
+
+static struct mutex stack_lock;
+static struct {
+  int tid;                // 0 表示栈空闲
+  char *stack;
+} uthreads[NUTHREAD];
+
+// 新线程从这里开始：栈顶放着 fn 和 arg。
+static void
+thread_start(void *a)
+{
+  uint64 *top = a;
+
+  ((void (*)(void *))top[0])((void *)top[1]);
+  exit(0);
+}
+
+// 创建线程运行 fn(arg)，返回线程 id，失败返回 -1。
+int
+thread_create(void (*fn)(void *), void *arg)
+{
+  char *stack;
+  uint64 *top;
+  int tid, i;
+
+  // 优先复用已回收线程的栈。tid 暂置为 -1 占住这一项。
+  mutex_lock(&stack_lock);
+  for(i = 0; i < NUTHREAD; i++)
+    if(uthreads[i].stack && uthreads[i].tid == 0)
+      break;
+  if(i == NUTHREAD){
+    for(i = 0; i < NUTHREAD; i++)
+      if(uthreads[i].stack == 0)
+        break;
+    if(i == NUTHREAD || (stack = sbrk(TSTACK)) == (char *)-1){
+      mutex_unlock(&stack_lock);
+      return -1;
+    }
+    uthreads[i].stack = stack;
+  }
+  stack = uthreads[i].stack;
+  uthreads[i].tid = -1;
+  mutex_unlock(&stack_lock);
+
+  // 栈顶按 16 字节对齐，留出 fn 和 arg 的位置。
+  top = (uint64 *)(((uint64)stack + TSTACK) & ~15L) - 2;
+  top[0] = (uint64)fn;
+  top[1] = (uint64)arg;
+  tid = clone(thread_start, top, top);
+
+  mutex_lock(&stack_lock);
+  uthreads[i].tid = tid < 0 ? 0 : tid;
+  mutex_unlock(&stack_lock);
+  return tid;
+}
+
+// 等待线程 tid 退出，回收它的栈。
+int
+thread_join(int tid, int *status)
+{
+  if(join(tid, status) < 0)
+    return -1;
+  mutex_lock(&stack_lock);
+  for(int i = 0; i < NUTHREAD; i++){
+    if(uthreads[i].stack && uthreads[i].tid == tid){
+      uthreads[i].tid = 0;
+      break;
+    }
+  }
+  mutex_unlock(&stack_lock);
+  return tid;
+}
+
+// 结束当前线程。在进程的第一个线程中调用则结束整个进程。
+void
+thread_exit(int status)
+{
+  exit(status);
+}
+
+//
+// 基于 futex 的互斥锁和条件变量。锁字与条件变量都可以放在
+// shmat 得到的共享内存里，在进程之间使用。
+//
+// mutex->locked：0 空闲，1 已加锁且无人等待，2 已加锁且可能
+// 有人睡在 futex 上。只有 2 时解锁才需要进入内核。
+//
+
+void
+mutex_init(struct mutex *m)
+{
+  m->locked = 0;
+}
+
+void
+mutex_lock(struct mutex *m)
+{
+  // 临界区通常很短，先自旋一小会儿再睡。
+  for(int i = 0; i < 100; i++){
+    if(m->locked == 0 && __sync_bool_compare_and_swap(&m->locked, 0, 1))
+      return;
+  }
+  // 置为 2 表示有等待者；换出来的值是 0 说明拿到了锁。
+  while(__atomic_exchange_n(&m->locked, 2, __ATOMIC_ACQUIRE) != 0)
+    futex(&m->locked, FUTEX_WAIT, 2);
+}
+
+int
+mutex_trylock(struct mutex *m)
+{
+  if(!__sync_bool_compare_and_swap(&m->locked, 0, 1))
+    return -1;
+  return 0;
+}
+
+void
+mutex_unlock(struct mutex *m)
+{
+  if(__atomic_exchange_n(&m->locked, 0, __ATOMIC_RELEASE) == 2)
+    futex(&m->locked, FUTEX_WAKE, 1);
+}
+
+void
+cond_init(struct cond *c)
+{
+  c->seq = 0;
+}
+
+// 原子地释放 m 并睡眠，被唤醒后重新获得 m。
+// 与 pthread 一样可能虚假唤醒，调用者应在循环中检查条件。
+void
+cond_wait(struct cond *c, struct mutex *m)
+{
+  int seq = c->seq;
+
+  mutex_unlock(m);
+  // 解锁之后若有人 signal，seq 已经变化，FUTEX_WAIT 立即返回。
+  futex(&c->seq, FUTEX_WAIT, seq);
+  // 可能还有其他被唤醒的线程在等 m，按有等待者的方式加锁。
+  while(__atomic_exchange_n(&m->locked, 2, __ATOMIC_ACQUIRE) != 0)
+    futex(&m->locked, FUTEX_WAIT, 2);
+}
+
+void
+cond_signal(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_SEQ_CST);
+  futex(&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(struct cond *c)
+{
+  __atomic_fetch_add(&c->seq, 1, __ATOMIC_SEQ_CST);
+  futex(&c->seq, FUTEX_WAKE, 0x7fffffff);
+}
@@ -2,6 +2,7 @@
 
 struct stat;
 struct sysinfo; // in kernel/sysinfo.h
+struct tms;     // in kernel/times.h
 
 // system calls
 int fork(void);
@@ -17,11 +18,13 @@ int open(const char*, int);
 int mknod(const char*, short, short);
 int unlink(const char*);
 int fstat(int fd, struct stat*);
+int fsync(int fd);
 int link(const char*, const char*);
 int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
 int getpid(void);
+int getppid(void);
 char* sys_sbrk(int,int);
 int pause(int);
 int sleep(int);
@@ -29,6 +32,16 @@ int uptime(void);
 
 int trace(int);         // 用户态程序可以找到trace系统调用的跳板入口函数
 int sysinfo(struct sysinfo *);
+int times(struct tms *);
+int setpriority(int, int, int);
+int getpriority(int, int);   // 返回 20 - nice
+int sched_setscheduler(int, int, int);
+int sched_getscheduler(int);
+int sched_yield(void);
+int clone(void (*)(void *), void *, void *);
+int join(int, int *);
+int futex(volatile int *, int, int);
+int wait4(int, int *, int, void *);
 void kpgtbl(void);  	// LAB_PGTBL 打印页表
 // LAB_NET
 int bind(uint16);
@@ -39,6 +52,7 @@ int recv(uint16, uint32*, uint16*, char *, uint32);
 // #ifdef LAB_LOCK
 int rwlktest(void);
 int cpupin(int);
+int lockbench(int, int);
 // #endif
 
 // ulib.c
@@ -55,6 +69,8 @@ int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
 char* sbrk(int);
 char* sbrklazy(int);
+int nice(int);
+int waitpid(int, int *, int);
 // #ifdef LAB_LOCK
 int statistics(void*, int);
 // #endif
@@ -67,6 +83,29 @@ void *shmat(int shmid, const void *addr, int shmflg);
 int shmdt(const void *addr);
 int shmctl(int shmid, int cmd, void *buf);
 
+// 磁盘轮询模式和延迟测试
+int diskpoll(int);
+int disklat(int);
+
+// ulib.c 线程库
+struct mutex {
+  volatile int locked;
+};
+int thread_create(void (*)(void *), void *);
+int thread_join(int, int *);
+void thread_exit(int) __attribute__((noreturn));
+void mutex_init(struct mutex *);
+void mutex_lock(struct mutex *);
+int mutex_trylock(struct mutex *);
+void mutex_unlock(struct mutex *);
+struct cond {
+  volatile int seq;
+};
+void cond_init(struct cond *);
+void cond_wait(struct cond *, struct mutex *);
+void cond_signal(struct cond *);
+void cond_broadcast(struct cond *);
+
 // printf.c
 void fprintf(int, const char*, ...) __attribute__ ((format (printf, 2, 3)));
 void printf(const char*, ...) __attribute__ ((format (printf, 1, 2)));
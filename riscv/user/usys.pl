@@ -34,6 +34,7 @@ entry("open");
 entry("mknod");
 entry("unlink");
 entry("fstat");
+entry("fsync");
 entry("link");
 entry("mkdir");
 entry("chdir");
@@ -46,6 +47,21 @@ entry("uptime");
 
 entry("trace");     # 用户态下的程序通过调用trace函数来使用跟踪系统调用功能
 entry("sysinfo");
+
+# 调度
+entry("times");
+entry("setpriority");
+entry("getpriority");
+entry("sched_setscheduler");
+entry("sched_getscheduler");
+entry("sched_yield");
+
+# 线程
+entry("clone");
+entry("join");
+entry("futex");
+entry("wait4");
+entry("getppid");
 entry("kpgtbl");
 
 # 网络相关系统调用
@@ -57,6 +73,7 @@ entry("recv");
 # lock
 entry("rwlktest");
 entry("cpupin");
+entry("lockbench");
 
 entry("mmap");
 entry("munmap");
@@ -65,4 +82,8 @@ entry("munmap");
 entry("shmget");
 entry("shmat");
 entry("shmdt");
-entry("shmctl");
\ No newline at end of file
+entry("shmctl");
+
+# 磁盘轮询模式和延迟测试
+entry("diskpoll");
+entry("disklat");
\ No newline at end of file
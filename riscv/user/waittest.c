@@ -0,0 +1,144 @@
+#include "kernel/types.h"
+#include "kernel/wait.h"
+#include "user/user.h"
+
+// wait4()/waitpid() 与子进程链表测试
+
+#define NCHILD 20
+#define NIDLE 32      // 基准测试中常驻的子进程数
+#define NFORK 1000    // 基准测试中 fork/wait 的次数
+
+void
+fail(char *msg)
+{
+  printf("waittest: %s: FAIL\n", msg);
+  exit(1);
+}
+
+// 按与创建相反的顺序逐个等待指定的子进程。
+void
+test_order(void)
+{
+  int pids[NCHILD], status;
+
+  for(int i = 0; i < NCHILD; i++){
+    if((pids[i] = fork()) < 0)
+      fail("fork");
+    if(pids[i] == 0)
+      exit(i);
+  }
+  for(int i = NCHILD - 1; i >= 0; i--){
+    if(waitpid(pids[i], &status, 0) != pids[i] || status != i)
+      fail("waitpid order");
+  }
+  if(wait(0) != -1)
+    fail("wait with no children");
+  printf("order: OK\n");
+}
+
+// WNOHANG 在子进程未退出时返回 0；不是自己的子进程返回 -1。
+void
+test_nohang(void)
+{
+  int fds[2], pid, status;
+  char c;
+
+  if(pipe(fds) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(fds[1]);
+    read(fds[0], &c, 1);
+    exit(3);
+  }
+  close(fds[0]);
+  if(waitpid(pid, &status, WNOHANG) != 0)
+    fail("WNOHANG on running child");
+  if(waitpid(pid + 1000, &status, 0) != -1 || waitpid(1, &status, WNOHANG) != -1)
+    fail("waitpid on non-child");
+  close(fds[1]);
+  if(waitpid(pid, &status, 0) != pid || status != 3)
+    fail("waitpid after exit");
+  printf("nohang: OK\n");
+}
+
+// 父进程退出后，孙进程交给 init，不会被原来的祖父进程等到。
+void
+test_orphan(void)
+{
+  int pid, fds[2];
+  char c;
+
+  if(pipe(fds) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    if(fork() == 0){
+      // 孙进程：等祖父进程确认之后再退出
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+    exit(0);
+  }
+  close(fds[0]);
+  if(wait(0) != pid)
+    fail("wait child");
+  if(wait(0) != -1)
+    fail("grandchild not reparented");
+  close(fds[1]);
+  printf("orphan: OK\n");
+}
+
+// 有许多常驻子进程时反复 fork/wait 短命子进程。
+void
+bench(void)
+{
+  int fds[2], pid;
+  int t0, t1;
+  char c;
+
+  if(pipe(fds) < 0)
+    fail("pipe");
+  for(int i = 0; i < NIDLE; i++){
+    if((pid = fork()) < 0)
+      break;
+    if(pid == 0){
+      close(fds[1]);
+      read(fds[0], &c, 1);
+      exit(0);
+    }
+  }
+  close(fds[0]);
+
+  t0 = uptime();
+  for(int i = 0; i < NFORK; i++){
+    if((pid = fork()) < 0)
+      fail("fork in bench");
+    if(pid == 0)
+      exit(0);
+    if(waitpid(pid, 0, 0) != pid)
+      fail("waitpid in bench");
+  }
+  t1 = uptime();
+  printf("bench: %d fork/waitpid with %d idle children: %d ticks\n",
+         NFORK, NIDLE, t1 - t0);
+
+  close(fds[1]);
+  while(wait(0) > 0)
+    ;
+}
+
+int
+main(int argc, char *argv[])
+{
+  printf("waittest: start\n");
+  test_order();
+  test_nohang();
+  test_orphan();
+  bench();
+  printf("waittest: OK\n");
+  exit(0);
+}